@@ -11,6 +11,9 @@
  *-----------------------------------------------------------------*/
 
 #include "ABC.hpp"
+#include "Wavetable.hpp"
+#include "Shaper.hpp"
+#include "EnvCurve.hpp"
 
 
 Plugin *pluginInstance;
@@ -18,6 +21,10 @@ Plugin *pluginInstance;
 void init(rack::Plugin *p) {
 	pluginInstance = p;
 
+	wavetableBank.build(); // shared by all the oscillator instances
+	shaperBank.build(); // shared by all the wavefolder instances
+	envCurveBank.build(); // shared by all the envelope instances
+
 	p->addModel(modelAComparator);
 	p->addModel(modelAMuxDemux);
 	p->addModel(modelAClock);
@@ -355,3 +355,71 @@ struct valueKnob : RoundBlackKnob {
 
 	}
 };
+
+////////////////////
+// Control-rate coefficient update menu (SVF-based modules)
+////////////////////
+
+#define JSON_CTRLRATE_KEY "ctrlRate"
+#define CTRLRATE_MAX 64 // the longest period in the menu
+
+/* Context Menu Item for the coefficients update period (1 = every sample) */
+template <class TModule>
+struct CtrlRateMenuItem : MenuItem {
+	TModule *module;
+	unsigned int rate;
+	void onAction(const event::Action &e) override {
+		module->onCtrlRateChange(rate);
+	}
+};
+
+template <class TModule>
+void appendCtrlRateMenu(Menu *menu, TModule *module) {
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Coefficients update";
+	menu->addChild(modeLabel);
+
+	const unsigned int rates[] = { 1, 8, 16, 32, 64 };
+	for (unsigned int rate : rates) {
+		CtrlRateMenuItem<TModule> *item = new CtrlRateMenuItem<TModule>();
+		item->text = rate == 1 ? "Every sample" : "Every " + std::to_string(rate) + " samples";
+		item->module = module;
+		item->rate = rate;
+		item->rightText = CHECKMARK(module->ctrlRate == item->rate);
+		menu->addChild(item);
+	}
+}
+
+////////////////////
+// Oversampling factor menu (modules built on Oversampled.hpp)
+////////////////////
+
+#define JSON_OVSF_KEY "ovsFactor"
+
+/* Context Menu Item for the oversampling factor, applied by TModule::onOvsFactorChange() */
+template <class TModule>
+struct OvsFactorMenuItem : MenuItem {
+	TModule *module;
+	unsigned int ovsf;
+	void onAction(const event::Action &e) override {
+		module->onOvsFactorChange(ovsf);
+	}
+};
+
+template <class TModule>
+void appendOvsFactorMenu(Menu *menu, TModule *module, bool disabled = false) {
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Oversampling";
+	menu->addChild(modeLabel);
+
+	const unsigned int factors[] = { 1, 2, 4, 8, 16 };
+	for (unsigned int ovsf : factors) {
+		OvsFactorMenuItem<TModule> *item = new OvsFactorMenuItem<TModule>();
+		item->text = std::to_string(ovsf) + "x";
+		item->module = module;
+		item->ovsf = ovsf;
+		item->rightText = CHECKMARK(module->ovsFactor == item->ovsf);
+		item->disabled = disabled;
+		menu->addChild(item);
+	}
+}
@@ -11,11 +11,13 @@
  *-----------------------------------------------------------------*/
 
 #include "ABC.hpp"
-#include "DPW.hpp"
+#include "OscSelector.hpp"
+#include "Precision.hpp"
 
 using namespace::dsp;
 
-#define DPWOSC_TYPE double
+#define DPWOSC_PRECISION PREC_DOUBLE // see Precision.hpp. Float falls back to DPW 2 at low pitch
+#define DPWOSC_TYPE Precision<DPWOSC_PRECISION>::state
 
 template <typename T>
 struct ADPWOsc : Module {
@@ -32,6 +34,8 @@ struct ADPWOsc : Module {
 	};
 	enum OutputIds {
 		SAW_OUT,
+		SQU_OUT,
+		TRI_OUT,
 		NUM_OUTPUTS,
 	};
 
@@ -39,20 +43,24 @@ struct ADPWOsc : Module {
 		NUM_LIGHTS,
 	};
 
-	DPW<T> *Osc;
-	unsigned int dpwOrder = 1;
+	OscSelector<T> *Osc;
+	unsigned int dpwOrder = 1; // DPW order, or OSC_POLYBLEP, OSC_WAVETABLE
 
 	ADPWOsc() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam(PITCH_PARAM, -54.f, 54.f, 0.f, "Pitch", " Hz", std::pow(2.f, 1.f/12.f), dsp::FREQ_C4, 0.f);
 		configParam(FMOD_PARAM, 0.f, 1.f, 0.f, "Modulation");
-		Osc = new DPW<T>();
+		Osc = new OscSelector<T>();
 	}
 
 	void process(const ProcessArgs &args) override;
 
 	void onDPWOrderChange(unsigned int newdpw) {
-		dpwOrder = Osc->onDPWOrderChange(newdpw); // this function also checks the validity of the input
+		dpwOrder = Osc->onEngineChange(newdpw); // this function also checks the validity of the input
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		Osc->setSampleTime(e.sampleTime);
 	}
 
 };
@@ -60,6 +68,17 @@ struct ADPWOsc : Module {
 
 template <typename T> void ADPWOsc<T>::process(const ProcessArgs &args) {
 
+	// only the connected waveforms are computed
+	unsigned int mask = 0;
+	if (outputs[SAW_OUT].isConnected())
+		mask |= MASK_SAW;
+	if (outputs[SQU_OUT].isConnected())
+		mask |= MASK_SQU;
+	if (outputs[TRI_OUT].isConnected())
+		mask |= MASK_TRI;
+	if (mask == 0)
+		return;
+
 	float pitchKnob = params[PITCH_PARAM].getValue();
 	float pitchCV = 12.f * inputs[VOCT_IN].getVoltage();
 	if (inputs[FMOD_IN].isConnected()) {
@@ -67,12 +86,15 @@ template <typename T> void ADPWOsc<T>::process(const ProcessArgs &args) {
 	}
 	T pitch = dsp::FREQ_C4 * std::pow(2.f, (pitchKnob + pitchCV) / 12.f);
 
-	Osc->setPitch(pitch);
-	T out = Osc->process();
+	T out[NUM_WAVETYPES];
+	Osc->process(pitch, out, mask);
 
-	if(outputs[SAW_OUT].isConnected()) {
-		outputs[SAW_OUT].setVoltage(5.f * out);
-	}
+	if (mask & MASK_SAW)
+		outputs[SAW_OUT].setVoltage(5.f * out[TYPE_SAW]);
+	if (mask & MASK_SQU)
+		outputs[SQU_OUT].setVoltage(5.f * out[TYPE_SQU]);
+	if (mask & MASK_TRI)
+		outputs[TRI_OUT].setVoltage(5.f * out[TYPE_TRI]);
 
 }
 
@@ -109,8 +131,18 @@ ADPWOscWidget::ADPWOscWidget(ADPWOsc<DPWOSC_TYPE> * module) {
 		addChild(title);
 	}
 	{
-		ATextHeading * title = new ATextHeading(Vec(15, 190));
-		title->setText("SAWTOOTH");
+		ATextLabel * title = new ATextLabel(Vec(5, 200));
+		title->setText("SAW");
+		addChild(title);
+	}
+	{
+		ATextLabel * title = new ATextLabel(Vec(5, 240));
+		title->setText("SQUARE");
+		addChild(title);
+	}
+	{
+		ATextLabel * title = new ATextLabel(Vec(5, 280));
+		title->setText("TRI");
 		addChild(title);
 	}
 
@@ -121,7 +153,9 @@ ADPWOscWidget::ADPWOscWidget(ADPWOsc<DPWOSC_TYPE> * module) {
 	addParam(createParam<RoundBlackKnob>(Vec(30, 40), module, ADPWOsc<DPWOSC_TYPE>::PITCH_PARAM));
 	addParam(createParam<RoundSmallBlackKnob>(Vec(23,140), module, ADPWOsc<DPWOSC_TYPE>::FMOD_PARAM));
 
-	addOutput(createOutput<PJ3410Port>(Vec(30, 230), module, ADPWOsc<DPWOSC_TYPE>::SAW_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 208), module, ADPWOsc<DPWOSC_TYPE>::SAW_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 248), module, ADPWOsc<DPWOSC_TYPE>::SQU_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 288), module, ADPWOsc<DPWOSC_TYPE>::TRI_OUT));
 
 }
 
@@ -172,6 +206,20 @@ void ADPWOscWidget::appendContextMenu(Menu *menu) {
 	dpw4Item->rightText = CHECKMARK(module->dpwOrder == dpw4Item->dpword);
 	menu->addChild(dpw4Item);
 
+	OscDPWOrderMenuItem *blepItem = new OscDPWOrderMenuItem();
+	blepItem->text = "PolyBLEP";
+	blepItem->dpwosc = module;
+	blepItem->dpword = OSC_POLYBLEP;
+	blepItem->rightText = CHECKMARK(module->dpwOrder == blepItem->dpword);
+	menu->addChild(blepItem);
+
+	OscDPWOrderMenuItem *wtItem = new OscDPWOrderMenuItem();
+	wtItem->text = "Wavetable";
+	wtItem->dpwosc = module;
+	wtItem->dpword = OSC_WAVETABLE;
+	wtItem->rightText = CHECKMARK(module->dpwOrder == wtItem->dpword);
+	menu->addChild(wtItem);
+
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
 	menu->addChild(spacerLabel2);
@@ -15,6 +15,15 @@
 #include "RCFilter.hpp"
 
 #define EPSILON 1e-9
+#define POLYCHMAX 16
+#define ENV_THRESHOLD 0.001f // a stage ends this close to its target
+
+typedef enum {
+	STAGE_ATK,
+	STAGE_DEC,
+	STAGE_REL,
+	NUM_STAGES,
+} ENVSTAGE;
 
 struct AExpADSR : Module {
 	enum ParamIds {
@@ -47,69 +56,143 @@ struct AExpADSR : Module {
 		configParam(PARAM_SUS, 0.0, 1.0, 0.5, "Sustain Time", " s");
 		configParam(PARAM_REL, 0.0, 5.0, 0.5, "Release Time", " s");
 
-		isAtk = false;
-		isRunning = false;
-		env = 0.0;
-		Atau = Dtau = Rtau = 0.f;
+		for (int c = 0; c < POLYCHMAX/4; c++) {
+			isAtk[c] = isDec[c] = isRel[c] = isRunning[c] = 0.f;
+			gateN1[c] = T::mask(); // like SchmittTrigger: no edge if the gate is high at start
+			env[c] = a[c] = b[c] = 0.f;
+			left[c] = INFINITY;
+		}
+		tau[STAGE_ATK] = tau[STAGE_DEC] = tau[STAGE_REL] = -1.f;
+		sus = 0.f;
+		sampleTime = APP->engine->getSampleTime();
 	}
 
-	dsp::SchmittTrigger gateDetect;
-	RCFilter<float> * rcf = new RCFilter<float>(0.999);
-	bool isAtk, isRunning;
-	float Atau, Dtau, Rtau;
-	float env;
+	/*
+	 * 4 voices per group, one per lane. The stage flags are lane masks. Within a stage each
+	 * lane follows env = a env + b, the one-pole lowpass towards the stage target, for left
+	 * more samples: the coefficients and the stage ends are computed when a lane enters
+	 * a stage, and the stage flags only checked when a gate changes or a stage ends.
+	 * Sustain and idle lanes hold their level with a = 0.
+	 */
+	typedef simd::float_4 T;
+	T gateN1[POLYCHMAX/4]; // gate at the previous sample, for the rising and falling edges
+	T isAtk[POLYCHMAX/4], isDec[POLYCHMAX/4], isRel[POLYCHMAX/4], isRunning[POLYCHMAX/4];
+	T env[POLYCHMAX/4];
+	T a[POLYCHMAX/4], b[POLYCHMAX/4];
+	T left[POLYCHMAX/4];
+
+	// per-stage coefficients, recomputed on parameter or sample rate changes only
+	float tau[NUM_STAGES], coeff[NUM_STAGES], invLogCoeff[NUM_STAGES];
+	float sus;
+	float sampleTime;
 
 	void process(const ProcessArgs &args) override;
 
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		sampleTime = e.sampleTime;
+		tau[STAGE_ATK] = tau[STAGE_DEC] = tau[STAGE_REL] = -1.f; // recompute at the next sample
+	}
+
+	void coeffsCompute(int g);
+	void enterStage(int g, T lanes, int stage, T target);
+	void enterHold(int g, T lanes, T level);
+	void stagesUpdate(int g, T gate);
+
 };
 
+/*
+ * Lanes enter a stage: with d the distance from the target, the stage ends when
+ * d a^n <= ENV_THRESHOLD, after n = log(ENV_THRESHOLD / d) / log(a) samples
+ */
+void AExpADSR::enterStage(int g, T lanes, int stage, T target) {
+	T d = simd::fmax(simd::fabs(target - env[g]), ENV_THRESHOLD);
+	a[g] = simd::ifelse(lanes, coeff[stage], a[g]);
+	b[g] = simd::ifelse(lanes, (1.f - coeff[stage]) * target, b[g]);
+	left[g] = simd::ifelse(lanes, simd::log(ENV_THRESHOLD / d) * invLogCoeff[stage], left[g]);
+}
 
-void AExpADSR::process(const ProcessArgs &args) {
-	float sus = params[PARAM_SUS].getValue();
+void AExpADSR::enterHold(int g, T lanes, T level) {
+	a[g] = simd::ifelse(lanes, 0.f, a[g]);
+	b[g] = simd::ifelse(lanes, level, b[g]);
+	left[g] = simd::ifelse(lanes, INFINITY, left[g]);
+}
+
+/*
+ * New coefficients: the lanes restart their stage from their current level
+ */
+void AExpADSR::coeffsCompute(int g) {
+	enterStage(g, isAtk[g], STAGE_ATK, 1.f);
+	enterStage(g, isDec[g], STAGE_DEC, sus);
+	enterStage(g, isRel[g], STAGE_REL, 0.f);
+	enterHold(g, isRunning[g] & ~(isAtk[g] | isDec[g] | isRel[g]), sus);
+}
 
-	Atau = clamp(params[PARAM_ATK].getValue(), EPSILON, 5.0);
-	Dtau = clamp(params[PARAM_DEC].getValue(), EPSILON, 5.0);
-	Rtau = clamp(params[PARAM_REL].getValue(), EPSILON, 5.0);
+/*
+ * Gate edges and stage ends. A rising gate starts the attack, a falling one the release
+ * of the running lanes. The attack is followed by the decay, the decay by the sustain,
+ * the release by silence
+ */
+void AExpADSR::stagesUpdate(int g, T gate) {
+	T rise = gate & ~gateN1[g];
+	T fall = ~gate & gateN1[g] & isRunning[g];
+	T end = left[g] <= 0.f;
+
+	T atkEnd = end & isAtk[g] & ~fall;
+	T decEnd = end & isDec[g] & ~fall;
+	T relEnd = end & isRel[g] & ~rise;
+
+	isAtk[g] = (isAtk[g] & ~atkEnd & ~fall) | rise;
+	isDec[g] = (isDec[g] | atkEnd) & ~decEnd & ~fall & ~rise;
+	isRel[g] = (isRel[g] | fall) & ~relEnd & ~rise;
+	isRunning[g] = (isRunning[g] & ~relEnd) | rise;
+
+	enterStage(g, rise, STAGE_ATK, 1.f);
+	enterStage(g, atkEnd, STAGE_DEC, sus);
+	enterHold(g, decEnd, sus);
+	enterStage(g, fall, STAGE_REL, 0.f);
+	enterHold(g, relEnd, 0.f);
+	env[g] = simd::ifelse(decEnd, sus, simd::ifelse(relEnd, 0.f, env[g]));
+}
 
-	bool gate = inputs[IN_GATE].getVoltage() >= 1.0;
-	if (gateDetect.process(gate)) {
-		isAtk = true;
-		isRunning = true;
-	}
+void AExpADSR::process(const ProcessArgs &args) {
 
-	if (isRunning) {
-		if (gate) {
-			if (isAtk) {
-				// ATK
-				rcf->setTau(Atau);
-				env = rcf->process(1.0);
-				if (env >= 1.0 - 0.001) {
-					isAtk = false;
-				}
-			}
-			else {
-				// DEC
-				rcf->setTau(Dtau);
-				if (env <= sus + 0.001)
-					env = sus;
-				else
-					env = rcf->process(sus);
-			}
-		} else {
-			// REL
-			rcf->setTau(Rtau);
-			env = rcf->process(0.0);
-			if (env <= 0.001)
-				isRunning = false;
+	const int stageParam[NUM_STAGES] = { PARAM_ATK, PARAM_DEC, PARAM_REL };
+
+	float newSus = params[PARAM_SUS].getValue();
+	bool changed = (newSus != sus);
+	for (int s = 0; s < NUM_STAGES; s++) {
+		float t = clamp(params[stageParam[s]].getValue(), EPSILON, 5.0);
+		if (t != tau[s]) {
+			tau[s] = t;
+			coeff[s] = RCFilter<float>::tauToCoeff(t, sampleTime);
+			invLogCoeff[s] = 1.f / std::log(coeff[s]);
+			changed = true;
 		}
-	} else {
-		env = 0.0;
 	}
+	sus = newSus;
+
+	// all the groups, also those beyond the current channel count: they resume where they stopped
+	if (changed) {
+		for (int g = 0; g < POLYCHMAX/4; g++)
+			coeffsCompute(g);
+	}
+
+	int inChanN = clamp(inputs[IN_GATE].getChannels(), 1, POLYCHMAX);
+
+	for (int c = 0; c < inChanN; c += 4) {
+		int g = c/4;
+
+		T gate = inputs[IN_GATE].getVoltageSimd<T>(c) >= 1.f;
+		if (simd::movemask((gate ^ gateN1[g]) | (left[g] <= 0.f)))
+			stagesUpdate(g, gate);
+		gateN1[g] = gate;
 
+		env[g] = a[g] * env[g] + b[g];
+		left[g] -= 1.f;
 
-	if (outputs[OUT_ENVELOPE].isConnected()) {
-		outputs[OUT_ENVELOPE].setVoltage(10.0 * env);
+		outputs[OUT_ENVELOPE].setVoltageSimd(10.f * env[g], c);
 	}
+	outputs[OUT_ENVELOPE].setChannels(inChanN);
 
 }
 
@@ -11,9 +11,20 @@
  *-----------------------------------------------------------------*/
 
 #include "ABC.hpp"
-#include "dsp/digital.hpp"
+#include "EnvCurve.hpp"
+#include "Precision.hpp"
 
 #define EPSILON 1e-9f
+#define POLYCHMAX 16
+#define JSON_CURVE_FAMILY_KEY "curveFamily"
+#define NODE_MIN_SAMPLES 16 // shortest stretch between two curve nodes, in samples
+
+typedef enum {
+	SEG_ATK,
+	SEG_DEC,
+	SEG_REL,
+	NUM_SEGMENTS,
+} ENVSEGMENT;
 
 struct ALinADSR : Module {
 	enum ParamIds {
@@ -21,6 +32,9 @@ struct ALinADSR : Module {
 		PARAM_DEC,
 		PARAM_SUS,
 		PARAM_REL,
+		PARAM_ATK_CURVE,
+		PARAM_DEC_CURVE,
+		PARAM_REL_CURVE,
 		NUM_PARAMS,
 	};
 
@@ -45,71 +59,222 @@ struct ALinADSR : Module {
 		configParam(PARAM_DEC, 0.f, 5.f, 0.5f, "Decay", " s");
 		configParam(PARAM_SUS, 0.f, 1.f, 0.5f, "Sustain");
 		configParam(PARAM_REL, 0.f, 5.f, 0.5f, "Release", " s");
-		isAtk = false;
-		isRunning = false;
-		env = 0.0;
+		configParam(PARAM_ATK_CURVE, -1.f, 1.f, 0.f, "Attack curvature");
+		configParam(PARAM_DEC_CURVE, -1.f, 1.f, 0.f, "Decay curvature");
+		configParam(PARAM_REL_CURVE, -1.f, 1.f, 0.f, "Release curvature");
+		for (int c = 0; c < POLYCHMAX/4; c++) {
+			isAtk[c] = isDec[c] = isRel[c] = isRunning[c] = 0.f;
+			gateN1[c] = T::mask(); // like SchmittTrigger: no edge if the gate is high at start
+			env[c] = slope[c] = base[c] = span[c] = step[c] = node[c] = 0.f;
+			left[c] = INFINITY;
+		}
+		for (int s = 0; s < NUM_SEGMENTS; s++)
+			time[s] = curvature[s] = -2.f;
+		sus = 0.f;
+		sampleRate = APP->engine->getSampleRate();
 	}
 
-	dsp::SchmittTrigger gateDetect;
-	bool isAtk, isRunning;
+	/*
+	 * 4 voices per group, one per lane. The stage flags are lane masks. Within a segment
+	 * the level of a lane is base + span f(pos), with f the curve of the segment and pos
+	 * advancing by step table units per sample. Between two nodes of the table the curve
+	 * is a straight line: the lane adds slope for left more samples, then reads the table
+	 * again. The table is read at most every NODE_MIN_SAMPLES samples, whatever the
+	 * curvature, and the stage flags only checked when a gate changes or a node is reached.
+	 * Sustain and idle lanes hold their level with slope = 0.
+	 */
+	typedef simd::float_4 T;
+	T gateN1[POLYCHMAX/4]; // gate at the previous sample, for the rising and falling edges
+	T isAtk[POLYCHMAX/4], isDec[POLYCHMAX/4], isRel[POLYCHMAX/4], isRunning[POLYCHMAX/4];
+	T env[POLYCHMAX/4];
+	T slope[POLYCHMAX/4], left[POLYCHMAX/4];
+	T base[POLYCHMAX/4], span[POLYCHMAX/4];
+	T step[POLYCHMAX/4], node[POLYCHMAX/4]; // node: the position of the next table read
 
-	float env;
+	// per-segment steps and curves, recomputed on parameter or sample rate changes only
+	EnvCurveSet<NUM_SEGMENTS> curves;
+	unsigned int curveFamily = CURVE_EXP;
+	float time[NUM_SEGMENTS], segStep[NUM_SEGMENTS], curvature[NUM_SEGMENTS];
+	float sus;
+	float sampleRate;
 
 	void process(const ProcessArgs &args) override;
 
+	json_t *dataToJson() override;
+	void dataFromJson(json_t *rootJ) override;
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		sampleRate = e.sampleRate;
+		time[SEG_ATK] = time[SEG_DEC] = time[SEG_REL] = -1.f; // recompute at the next sample
+	}
+
+	void onCurveFamilyChange(unsigned int newFamily) {
+		curveFamily = newFamily;
+		curvature[SEG_ATK] = curvature[SEG_DEC] = curvature[SEG_REL] = -2.f; // reload at the next sample
+	}
+
+	void nodesNext(int g, T lanes, T pos);
+	void segmentsCompute(int g);
+	void stagesUpdate(int g, T gate);
+
 };
 
+/*
+ * The lanes at pos read their level from the table and head for the next node, at least
+ * NODE_MIN_SAMPLES samples away or at the end of the segment. All the moving lanes of a
+ * group are sent on together, so that the group does not come back here before
+ * NODE_MIN_SAMPLES samples
+ */
+void ALinADSR::nodesNext(int g, T lanes, T pos) {
+	pos = simd::ifelse(lanes, pos, 0.f); // the other lanes may hold an infinite left
+	// row of each lane in the table of the segment curves, as a position
+	T row = simd::ifelse(isAtk[g], SEG_ATK, simd::ifelse(isDec[g], SEG_DEC, SEG_REL)) * (CURVE_SIZE + 1);
+	T i = simd::trunc(simd::fmin(pos, CURVE_SIZE - 1));
+	T m = simd::fmin(simd::trunc(pos + NODE_MIN_SAMPLES * step[g]) + 1.f, CURVE_SIZE);
+
+	int i0[4], im[4];
+	for (int l = 0; l < 4; l++) {
+		i0[l] = (int)(row[l] + i[l]);
+		im[l] = (int)(row[l] + m[l]);
+	}
+	const float * f = curves.table();
+	T f0 = Lanes<T>::gather(f, i0), f1 = Lanes<T>::gather(f + 1, i0), fm = Lanes<T>::gather(f, im);
+
+	T y = base[g] + span[g] * (f0 + (pos - i) * (f1 - f0));
+	T n = simd::fmax((m - pos) / step[g], 1.f);
+	env[g] = simd::ifelse(lanes, y, env[g]);
+	node[g] = simd::ifelse(lanes, m, node[g]);
+	left[g] = simd::ifelse(lanes, n, left[g]);
+	slope[g] = simd::ifelse(lanes, (base[g] + span[g] * fm - y) / n, slope[g]);
+}
+
+/*
+ * New steps, curves or sustain level: the lanes keep their position in the segment
+ */
+void ALinADSR::segmentsCompute(int g) {
+	T moving = isAtk[g] | isDec[g] | isRel[g];
+	T pos = node[g] - left[g] * step[g];
+	step[g] = simd::ifelse(isAtk[g], segStep[SEG_ATK], step[g]);
+	step[g] = simd::ifelse(isDec[g], segStep[SEG_DEC], step[g]);
+	step[g] = simd::ifelse(isRel[g], segStep[SEG_REL], step[g]);
+	span[g] = simd::ifelse(isDec[g], sus - 1.f, span[g]);
+	T hold = isRunning[g] & ~moving;
+	base[g] = simd::ifelse(hold, sus, base[g]);
+	env[g] = simd::ifelse(hold, sus, env[g]);
+
+	if (simd::movemask(moving))
+		nodesNext(g, moving, simd::fmax(pos, 0.f));
+}
+
+/*
+ * Gate edges, segment ends and nodes. A rising gate starts the attack from the current
+ * level, a falling one the release of the running lanes. The attack is followed by the
+ * decay, the decay by the sustain, the release by silence
+ */
+void ALinADSR::stagesUpdate(int g, T gate) {
+	T rise = gate & ~gateN1[g];
+	T fall = ~gate & gateN1[g] & isRunning[g];
+	T end = (left[g] < 1.f) & (node[g] >= CURVE_SIZE);
+
+	T atkEnd = end & isAtk[g] & ~fall;
+	T decEnd = end & isDec[g] & ~fall;
+	T relEnd = end & isRel[g] & ~rise;
+	T pos = simd::fmax(node[g] - left[g] * step[g], 0.f);
+
+	isAtk[g] = (isAtk[g] & ~atkEnd & ~fall) | rise;
+	isDec[g] = (isDec[g] | atkEnd) & ~decEnd & ~fall & ~rise;
+	isRel[g] = (isRel[g] | fall) & ~relEnd & ~rise;
+	isRunning[g] = (isRunning[g] & ~relEnd) | rise;
+
+	// the attack rises from the current level, the release falls from it
+	T level = env[g];
+	int r = simd::movemask(rise);
+	for (int l = 0; l < 4; l++)
+		if (r & (1 << l))
+			pos[l] = curves.inverse(SEG_ATK, level[l]);
+	pos = simd::ifelse(atkEnd | fall, 0.f, pos);
+	step[g] = simd::ifelse(rise, segStep[SEG_ATK], step[g]);
+	step[g] = simd::ifelse(atkEnd, segStep[SEG_DEC], step[g]);
+	step[g] = simd::ifelse(fall, segStep[SEG_REL], step[g]);
+	base[g] = simd::ifelse(rise, 0.f, simd::ifelse(atkEnd, 1.f, simd::ifelse(fall, level, base[g])));
+	span[g] = simd::ifelse(rise, 1.f, simd::ifelse(atkEnd, sus - 1.f, simd::ifelse(fall, -level, span[g])));
+
+	T hold = decEnd | relEnd;
+	T holdLevel = simd::ifelse(decEnd, sus, 0.f);
+	base[g] = simd::ifelse(hold, holdLevel, base[g]);
+	env[g] = simd::ifelse(hold, holdLevel, env[g]);
+	slope[g] = simd::ifelse(hold, 0.f, slope[g]);
+	left[g] = simd::ifelse(hold, INFINITY, left[g]);
+
+	T moving = isAtk[g] | isDec[g] | isRel[g];
+	if (simd::movemask(moving))
+		nodesNext(g, moving, pos);
+}
+
 void ALinADSR::process(const ProcessArgs &args) {
 
-	float sus = params[PARAM_SUS].getValue();
-	float Astep = 1.f / (EPSILON + args.sampleRate * params[PARAM_ATK].getValue());
-	float Dstep = (sus - 1.0) / (EPSILON + args.sampleRate * params[PARAM_DEC].getValue());
-	float Rstep = -(sus + EPSILON) / (EPSILON + args.sampleRate * params[PARAM_REL].getValue());
+	const int segParam[NUM_SEGMENTS] = { PARAM_ATK, PARAM_DEC, PARAM_REL };
+	const int curveParam[NUM_SEGMENTS] = { PARAM_ATK_CURVE, PARAM_DEC_CURVE, PARAM_REL_CURVE };
+	const float maxStep[NUM_SEGMENTS] = { 0.5f, 0.5f, 1.f }; // fraction of the segment per sample
 
-	Astep = clamp(Astep, EPSILON, 0.5);
-	Dstep = std::max(Dstep, -0.5f);//risolvere problema: quando d è al minimo ad ogni step env oscilla tra -0.5 e 0.0
-	Rstep = std::max(Rstep, -1.f);
+	float newSus = params[PARAM_SUS].getValue();
+	bool changed = (newSus != sus);
+	for (int s = 0; s < NUM_SEGMENTS; s++) {
+		float t = params[segParam[s]].getValue();
+		if (t != time[s]) {
+			time[s] = t;
+			segStep[s] = CURVE_SIZE * clamp(1.f / (EPSILON + sampleRate * t), EPSILON, maxStep[s]);
+			changed = true;
+		}
+		float k = params[curveParam[s]].getValue();
+		if (k != curvature[s]) {
+			curvature[s] = k;
+			curves.set(s, curveFamily, k);
+			changed = true;
+		}
+	}
+	sus = newSus;
 
-	bool gate = inputs[IN_GATE].getVoltage() >= 1.0;
-	if (gateDetect.process(gate)) {
-		isAtk = true;
-		isRunning = true;
+	// all the groups, also those beyond the current channel count: they resume where they stopped
+	if (changed) {
+		for (int g = 0; g < POLYCHMAX/4; g++)
+			segmentsCompute(g);
 	}
 
+	int inChanN = clamp(inputs[IN_GATE].getChannels(), 1, POLYCHMAX);
 
-	if (isRunning) {
-		if (gate) {
-			// ATK
-			if (isAtk) {
-				env += Astep;
-				if (env >= 1.0)
-					isAtk = false;
-			}
-			else {
-				// DEC
-				if (env <= sus + 0.001) {
-					env = sus;
-				}
-				else {
-					env += Dstep;
-				}
-			}
-		} else {
-			// REL
-			env += Rstep;
-			if (env <= Rstep)
-				isRunning = false;
-		}
-	} else {
-		env = 0.0;
+	for (int c = 0; c < inChanN; c += 4) {
+		int g = c/4;
+
+		T gate = inputs[IN_GATE].getVoltageSimd<T>(c) >= 1.f;
+		if (simd::movemask((gate ^ gateN1[g]) | (left[g] < 1.f)))
+			stagesUpdate(g, gate);
+		gateN1[g] = gate;
+
+		env[g] += slope[g];
+		left[g] -= 1.f;
+
+		outputs[OUT_ENVELOPE].setVoltageSimd(10.f * env[g], c);
 	}
+	outputs[OUT_ENVELOPE].setChannels(inChanN);
+}
+
+json_t *ALinADSR::dataToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, JSON_CURVE_FAMILY_KEY, json_integer(curveFamily));
+
+	return rootJ;
+}
 
-	if (outputs[OUT_ENVELOPE].isConnected()) {
-		outputs[OUT_ENVELOPE].setVoltage(10.f * env);
+void ALinADSR::dataFromJson(json_t *rootJ) {
+	json_t *familyJ = json_object_get(rootJ, JSON_CURVE_FAMILY_KEY);
+	if (familyJ) {
+		onCurveFamilyChange(json_integer_value(familyJ));
 	}
 }
 
 struct ALinADSRWidget : ModuleWidget {
+	void appendContextMenu(Menu *menu) override;
 	ALinADSRWidget(ALinADSR * module) {
 
 		setModule(module);
@@ -163,6 +328,10 @@ struct ALinADSRWidget : ModuleWidget {
 		addParam(createParam<RoundBlackKnob>(Vec(45, 160), module, ALinADSR::PARAM_SUS));
 		addParam(createParam<RoundBlackKnob>(Vec(45, 210), module, ALinADSR::PARAM_REL));
 
+		addParam(createParam<Trimpot>(Vec(15, 75), module, ALinADSR::PARAM_ATK_CURVE));
+		addParam(createParam<Trimpot>(Vec(15, 125), module, ALinADSR::PARAM_DEC_CURVE));
+		addParam(createParam<Trimpot>(Vec(15, 225), module, ALinADSR::PARAM_REL_CURVE));
+
 		addChild(createLight<SmallLight<GreenLight>>(Vec(20, 310), module, ALinADSR::LIGHT_GATE));
 
 	}
@@ -170,4 +339,32 @@ struct ALinADSRWidget : ModuleWidget {
 
 
 
+struct ALinADSRCurveMenuItem : MenuItem {
+	ALinADSR *module;
+	unsigned int curveFamily;
+	void onAction(const event::Action &e) override {
+		module->onCurveFamilyChange(curveFamily);
+	}
+};
+
+void ALinADSRWidget::appendContextMenu(Menu *menu) {
+	ALinADSR *module = dynamic_cast<ALinADSR*>(this->module);
+
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *curveLabel = new MenuLabel();
+	curveLabel->text = "Segment curves";
+	menu->addChild(curveLabel);
+
+	const char * curveNames[NUM_CURVES] = { "Logarithmic / exponential", "S-curve" };
+	for (int f = 0; f < NUM_CURVES; f++) {
+		ALinADSRCurveMenuItem *curveItem = new ALinADSRCurveMenuItem();
+		curveItem->text = curveNames[f];
+		curveItem->module = module;
+		curveItem->curveFamily = f;
+		curveItem->rightText = CHECKMARK(module->curveFamily == curveItem->curveFamily);
+		menu->addChild(curveItem);
+	}
+}
+
 Model *modelALinADSR = createModel<ALinADSR, ALinADSRWidget>("ALinADSR");
@@ -13,60 +13,126 @@
 #include "dsp/digital.hpp"
 #include "AModal.hpp"
 
-void AModal::process(const ProcessArgs &args) {
-
-	bool changeValues = false;
-	float fr = pow(params[PARAM_F0].getValue(), 10.0);
-	if (inputs[VOCT_IN].isConnected()) {
-		fr += dsp::FREQ_C4 * std::pow(2.f, 12.f * inputs[VOCT_IN].getVoltage() / 12.f);
-	}
-	if (f0 != fr) {
-		f0 = fr;
-		changeValues = true;
-	}
-	if (inhrm != params[PARAM_INHARM].getValue()) {
+/*
+ * Update the mode tables. A change of inharmonicity or damping rebuilds the frequency
+ * ratios and dampings of all modes, while a change of f0 alone just rescales the
+ * frequencies. Then each of the nv voices gets a table: voices with the same f0 share
+ * one, and a voice whose f0 did not change always keeps its table, so a steady chord
+ * costs nothing.
+ */
+void AModal::updateModes(const float *fr, int nv, float slopeOffset) {
+
+	float slope = params[PARAM_DAMPSLOPE].getValue() + slopeOffset;
+	if (inhrm != params[PARAM_INHARM].getValue() || damp != params[PARAM_DAMP].getValue() || dsl != slope) {
 		inhrm = params[PARAM_INHARM].getValue();
-		changeValues = true;
-	}
-	if (damp != params[PARAM_DAMP].getValue()) {
 		damp = params[PARAM_DAMP].getValue();
-		changeValues = true;
-	}
-	if (dsl != params[PARAM_DAMPSLOPE].getValue()) {
-		dsl = params[PARAM_DAMPSLOPE].getValue();
-		changeValues = true;
-	}
-
-	float mod_cv = params[PARAM_MOD_CV].getValue();
-
-	if (changeValues) {
-		for (int i = 0; i < MAX_OSC; i++) {
-			float f = f0 * (float)(i+1);
+		dsl = slope;
+		// the damping slope spans the whole table, whatever its size
+		int nLaw = (engine == MODAL_IFFT) ? FFT_MAX_OSC : MAX_OSC;
+		float slopeScale = (float)MAX_OSC / nLaw;
+		for (int i = 0; i < nLaw; i++) {
+			float r = (float)(i+1);
 			if ((i % 2) == 1)
-				 f *= inhrm;
+				 r *= inhrm;
 			float d = damp;
 			if (dsl >= 0.0)
-				d += (i * dsl);
+				d += (i * dsl * slopeScale);
 			else
-				d += ((MAX_OSC-i) * (-dsl));
-			osc[i]->setCoeffs(f, d);
+				d += ((nLaw-i) * (-dsl) * slopeScale);
+			if (engine == MODAL_IFFT) {
+				ifft->modeRatio[i] = r;
+				ifft->modeDamp[i] = d;
+			} else {
+				for (int t = 0; t < POLYCHMAX; t++)
+					tables[t].setMode(i, r, d);
+			}
 		}
+		if (engine == MODAL_IFFT) {
+			for (int t = 0; t < POLYCHMAX; t++)
+				ifft->tables[t].setAllDirty();
+		}
+	}
+
+	// first the voices whose pitch did not change keep their table
+	bool claimed[POLYCHMAX] = {};
+	bool placed[POLYCHMAX] = {};
+	for (int c = 0; c < nv; c++) {
+		if (tables[voiceTable[c]].f0 == fr[c]) {
+			claimed[voiceTable[c]] = true;
+			placed[c] = true;
+		}
+	}
+
+	// then the others: a table already playing their f0, their own table if still free
+	// (the coefficients ramp to the new f0), or a free table, computed at once
+	for (int c = 0; c < nv; c++) {
+		if (placed[c])
+			continue;
+		int t = -1;
+		for (int k = 0; k < POLYCHMAX && t < 0; k++) {
+			if (claimed[k] && tables[k].f0 == fr[c])
+				t = k;
+		}
+		if (t < 0 && !claimed[voiceTable[c]])
+			t = voiceTable[c];
+		for (int k = 0; k < POLYCHMAX && t < 0; k++) {
+			if (!claimed[k] && tables[k].f0 == fr[c])
+				t = k;
+		}
+		bool fresh = false;
+		for (int k = 0; k < POLYCHMAX && t < 0; k++) {
+			if (!claimed[k]) {
+				t = k;
+				fresh = true;
+			}
+		}
+		claimed[t] = true;
+		tables[t].setF0(fr[c]);
+		if (ifft)
+			ifft->tables[t].setF0(fr[c]);
+		if (fresh)
+			tables[t].updateNow();
+		voiceTable[c] = t;
 	}
+	for (int t = 0; t < POLYCHMAX; t++)
+		tableUsed[t] = claimed[t];
+}
 
-	float in = inputs[MAIN_IN].getVoltage();
+void AModal::process(const ProcessArgs &args) {
 
-	float invOut, cosOut, sinOut, cumOut = 0.0;
-	for (int i = 0; i < nActiveOsc; i++) {
-		osc[i]->process(in, &invOut, &cosOut, &sinOut);
-		cumOut += sinOut;
+	// one voice per channel of the excitation or of the V/OCT input
+	int nv = std::max(1, std::max(inputs[MAIN_IN].getChannels(), inputs[VOCT_IN].getChannels()));
+
+	// parameters are read once every ctrlRate samples, or as soon as the voice count changes
+	if (ctrlCounter == 0 || nv != nVoices) {
+		nVoices = nv;
+		float fr[POLYCHMAX];
+		float knobFr = pow(params[PARAM_F0].getValue(), 10.0);
+		for (int c = 0; c < nVoices; c++) {
+			fr[c] = knobFr;
+			if (inputs[VOCT_IN].isConnected()) {
+				fr[c] += dsp::FREQ_C4 * std::pow(2.f, 12.f * inputs[VOCT_IN].getPolyVoltage(c) / 12.f);
+			}
+		}
+		updateModes(fr, nVoices, 0.f);
 	}
+	if (++ctrlCounter >= ctrlRate)
+		ctrlCounter = 0;
+
+	updateCoeffs();
+
+	float mod_cv = params[PARAM_MOD_CV].getValue();
 
-	if (inputs[MOD1_IN].isConnected())
-		cumOut += cumOut * mod_cv * inputs[MOD1_IN].getVoltage();
+	for (int c = 0; c < nVoices; c++) {
+		float cumOut = processVoice(c, inputs[MAIN_IN].getPolyVoltage(c));
 
-	cumOut = cumOut / nActiveOsc;
-	if (outputs[MAIN_OUT].isConnected())
-		outputs[MAIN_OUT].setVoltage(cumOut);
+		if (inputs[MOD1_IN].isConnected())
+			cumOut += cumOut * mod_cv * inputs[MOD1_IN].getPolyVoltage(c);
+
+		outputs[MAIN_OUT].setVoltage(cumOut / activeModes(), c);
+	}
+	outputs[MAIN_OUT].setChannels(nVoices);
+	updateSkipRate();
 }
 
 
@@ -179,6 +245,34 @@ void AModalWidget::appendContextMenu(Menu *menu) {
 	nOsc64Item->rightText = CHECKMARK(module->nActiveOsc == nOsc64Item->nOsc);
 	menu->addChild(nOsc64Item);
 
+	nActiveOscMenuItem *nOsc256Item = new nActiveOscMenuItem();
+	nOsc256Item->text = "256 (IFFT)";
+	nOsc256Item->module = module;
+	nOsc256Item->nOsc = 256;
+	nOsc256Item->rightText = CHECKMARK(module->nActiveOsc == nOsc256Item->nOsc);
+	nOsc256Item->disabled = module->engine != MODAL_IFFT;
+	menu->addChild(nOsc256Item);
+
+	nActiveOscMenuItem *nOsc1024Item = new nActiveOscMenuItem();
+	nOsc1024Item->text = "1024 (IFFT)";
+	nOsc1024Item->module = module;
+	nOsc1024Item->nOsc = 1024;
+	nOsc1024Item->rightText = CHECKMARK(module->nActiveOsc == nOsc1024Item->nOsc);
+	nOsc1024Item->disabled = module->engine != MODAL_IFFT;
+	menu->addChild(nOsc1024Item);
+
+	menu->addChild(new MenuEntry);
+
+	appendEngineMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	appendCtrlRateMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	appendCullMenu(menu, module);
+
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
 	menu->addChild(spacerLabel2);
@@ -189,14 +283,30 @@ void AModalWidget::appendContextMenu(Menu *menu) {
 json_t *AModal::dataToJson() {
 	json_t *rootJ = json_object();
 	json_object_set_new(rootJ, JSON_NOSC_KEY, json_integer(nActiveOsc));
+	json_object_set_new(rootJ, JSON_CTRLRATE_KEY, json_integer(ctrlRate));
+	json_object_set_new(rootJ, JSON_CULL_KEY, json_real(cullThreshold));
+	json_object_set_new(rootJ, JSON_ENGINE_KEY, json_integer(engine));
 
 	return rootJ;
 }
 
 void AModal::dataFromJson(json_t *rootJ) {
+	json_t *ctrlRateJ = json_object_get(rootJ, JSON_CTRLRATE_KEY);
+	if (ctrlRateJ) {
+		onCtrlRateChange(json_integer_value(ctrlRateJ));
+	}
+	json_t *cullJ = json_object_get(rootJ, JSON_CULL_KEY);
+	if (cullJ) {
+		setCullThreshold(json_number_value(cullJ));
+	}
+	json_t *engineJ = json_object_get(rootJ, JSON_ENGINE_KEY);
+	if (engineJ) {
+		onEngineChange(json_integer_value(engineJ));
+	}
+	// after the engine, that sets the range
 	json_t *nOscJ = json_object_get(rootJ, JSON_NOSC_KEY);
 	if (nOscJ) {
-		nActiveOsc = json_integer_value(nOscJ);
+		onNActiveOscChange(json_integer_value(nOscJ));
 	}
 }
 
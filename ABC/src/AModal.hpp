@@ -12,15 +12,40 @@
 
 #include "ABC.hpp"
 #include "dsp/digital.hpp"
-#include "SVF.hpp"
+#include "ModalBank.hpp"
+#include "ModalFFT.hpp"
+#include "ScopeRing.hpp"
 
 #define MAX_OSC 64
+#define FFT_MAX_OSC 1024 // modes of the IFFT engine
+#define POLYCHMAX 16
+#define COEFF_GROUPS_PER_SAMPLE 4 // groups of 4 modes whose coefficients are updated in one sample
 #define DAMP_SLOPE_MAX 0.01
 #define SCOPE_BUFFERSIZE 512
 #define MASS_BOX_W (15*6)
 #define JSON_XCOORD_KEY "hitPoint"
+#define JSON_SCOPEDEC_KEY "scopeDecimation"
 #define JSON_NOSC_KEY "nActiveOsc"
-
+#define JSON_CULL_KEY "cullThreshold"
+#define JSON_ENGINE_KEY "engine"
+#define CULL_THRESHOLD_DEFAULT 1e-4f // mode amplitude in V (-100 dB re 10 V)
+
+typedef enum {
+	MODAL_SVF,	// a bank of SVF resonators, up to MAX_OSC modes
+	MODAL_IFFT,	// additive synthesis by inverse FFT, up to FFT_MAX_OSC modes
+	NUM_MODAL_ENGINES,
+} MODALENGINE;
+
+/*
+ * State of the IFFT engine, about 600 KB: only allocated when the engine is selected
+ */
+struct ModalIFFTState {
+	ModalFFT<FFT_MAX_OSC> engine;
+	ModalFFTCoeffs<FFT_MAX_OSC> tables[POLYCHMAX];	// same role and voice assignment as AModal::tables
+	ModalFFTVoice<FFT_MAX_OSC> voices[POLYCHMAX];
+	alignas(16) float modeRatio[FFT_MAX_OSC];		// mode table
+	alignas(16) float modeDamp[FFT_MAX_OSC];
+};
 
 struct AModal : Module {
 	enum ParamIds {
@@ -48,10 +73,20 @@ struct AModal : Module {
 		NUM_LIGHTS,
 	};
 
-	SVF<float> * osc[MAX_OSC];
+	ModalCoeffs<MAX_OSC> tables[POLYCHMAX];	// coefficients, shared by the voices playing the same f0
+	ModalBank<MAX_OSC> voices[POLYCHMAX];	// resonators state of each voice
+	int voiceTable[POLYCHMAX];				// coefficient table of each voice
+	bool tableUsed[POLYCHMAX];
+	int nVoices = 1;
+	std::unique_ptr<ModalIFFTState> ifft;	// NULL until the IFFT engine is first selected
+	unsigned int engine = MODAL_SVF;
 	float out;
-	float f0, inhrm, damp, dsl;
+	float inhrm, damp, dsl;
 	float nActiveOsc;
+	float cullThreshold;
+	unsigned int ctrlRate = 1; // coefficients update period in samples
+	unsigned int ctrlCounter = 0;
+	float skipRate = 0.f; // average fraction of active modes culled by the bank
 
 	AModal() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -61,17 +96,119 @@ struct AModal : Module {
 		configParam(PARAM_DAMPSLOPE, -DAMP_SLOPE_MAX, DAMP_SLOPE_MAX, 0.f);
 		configParam(PARAM_MOD_CV, 0.f, 1.f, 0.f);
 		out = 0.0;
-		f0 = 100;
 		inhrm = 0.0;
 		damp = 0.5;
 		dsl = 0.0;
-		for (int i = 0; i < MAX_OSC; i++)
-			osc[i] = new SVF<float>(100*i, 0.1);
+		for (int t = 0; t < POLYCHMAX; t++) {
+			tables[t].setF0(100.f);
+			voiceTable[t] = t;
+			tableUsed[t] = false;
+		}
+		tableUsed[0] = true;
+		setCullThreshold(CULL_THRESHOLD_DEFAULT);
 		nActiveOsc = 16;
 	}
 
 	void process(const ProcessArgs &args) override;
 
+	int maxModes() {
+		return (engine == MODAL_IFFT) ? FFT_MAX_OSC : MAX_OSC;
+	}
+
+	/*
+	 * Modes actually synthesized. nActiveOsc is kept within maxModes(), the min only covers
+	 * process() reading the two across an engine change
+	 */
+	int activeModes() {
+		return std::min((int)nActiveOsc, maxModes());
+	}
+
+	void onNActiveOscChange(int newN) {
+		nActiveOsc = clamp(newN, 1, maxModes());
+	}
+
+	void updateSkipRate() {
+		int nModes = activeModes();
+		int culledNow = 0;
+		for (int c = 0; c < nVoices; c++)
+			culledNow += (engine == MODAL_IFFT) ? ifft->voices[c].culled : voices[c].culledModes(nModes);
+		skipRate += 0.0001f * ((float)culledNow / (nModes * nVoices) - skipRate);
+	}
+
+	void onCtrlRateChange(int newRate) {
+		ctrlRate = clamp(newRate, 1, CTRLRATE_MAX);
+		ctrlCounter = 0;
+	}
+
+	void setCullThreshold(float amp) {
+		cullThreshold = amp;
+		if (ifft)
+			ifft->engine.cullThreshold = amp;
+		for (int c = 0; c < POLYCHMAX; c++)
+			voices[c].setCullThreshold(amp);
+	}
+
+	/*
+	 * The IFFT state is allocated here, before process() can see the new engine, and then
+	 * kept: freeing it on the way back to the SVF bank could race with process()
+	 */
+	void onEngineChange(int newEngine) {
+		newEngine = clamp(newEngine, 0, NUM_MODAL_ENGINES - 1);
+		if (newEngine == MODAL_IFFT && !ifft) {
+			ModalIFFTState * state = new ModalIFFTState();
+			state->engine.cullThreshold = cullThreshold;
+			for (int t = 0; t < POLYCHMAX; t++)
+				state->tables[t].setF0(tables[t].f0);
+			ifft.reset(state);
+		}
+		for (int c = 0; c < POLYCHMAX; c++) {
+			voices[c].reset();
+			if (ifft)
+				ifft->voices[c].reset();
+		}
+		inhrm = -1.f; // forces a rebuild of the mode table
+		if (newEngine != MODAL_IFFT)
+			nActiveOsc = std::min((int)nActiveOsc, MAX_OSC); // before the engine, for activeModes()
+		engine = newEngine;
+	}
+
+	void updateModes(const float *fr, int nv, float slopeOffset);
+
+	/*
+	 * Per-sample coefficient work, done once per table in use rather than once per voice
+	 */
+	void updateCoeffs() {
+		if (engine == MODAL_IFFT)
+			return; // the IFFT engine reads its coefficients once per hop, in processVoice()
+
+		int nModes = activeModes();
+		for (int t = 0; t < POLYCHMAX; t++) {
+			if (!tableUsed[t])
+				continue;
+			// only the active modes are updated, a few groups per sample
+			tables[t].updateCoeffs(nModes, COEFF_GROUPS_PER_SAMPLE, ctrlRate);
+			tables[t].step(nModes);
+		}
+	}
+
+	float processVoice(int c, float in) {
+		if (engine == MODAL_IFFT) {
+			ModalFFTCoeffs<FFT_MAX_OSC> &table = ifft->tables[voiceTable[c]];
+			if (ifft->engine.hopDue(ifft->voices[c]))
+				table.update(ifft->modeRatio, ifft->modeDamp, activeModes());
+			return ifft->engine.process(in, activeModes(), ifft->voices[c], table);
+		}
+		return voices[c].process(in, activeModes(), tables[voiceTable[c]]);
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		for (int t = 0; t < POLYCHMAX; t++) {
+			tables[t].setSampleTime(e.sampleTime);
+			if (ifft)
+				ifft->tables[t].setSampleTime(e.sampleTime);
+		}
+	}
+
 	json_t *dataToJson() override;
 	void dataFromJson(json_t *rootJ) override;
 
@@ -83,8 +220,7 @@ struct AModal : Module {
 struct AModalGUI : AModal {
 
 	float hitVelocity, hitPoint = 0.f;
-	float audioBuffer[SCOPE_BUFFERSIZE];
-	unsigned int idx = 0; // buffer index
+	ScopeRing<SCOPE_BUFFERSIZE> scope; // written by process(), read by HammDisplay
 	bool hitPointChanged = false;
 
 	AModalGUI() {
@@ -114,6 +250,8 @@ struct HammDisplay : Widget {
 	const float thresV = 1;
 	const float massR = 0.8;
 	const float massRadius = 5;
+	float scopeMin[SCOPE_BUFFERSIZE] = {};
+	float scopeMax[SCOPE_BUFFERSIZE] = {};
 
 	HammDisplay(float hitPoint = MASS_BOX_W/2.f) {
 		massX = hitPoint;
@@ -164,17 +302,16 @@ struct HammDisplay : Widget {
 
 		}
 
-		// Draw waveform
+		// Draw waveform: the max envelope left to right, then the min envelope back
 		nvgStrokeColor(args.vg, nvgRGBA(0xe1, 0x02, 0x78, 0xc0));
-		float * buf = module->audioBuffer;
+		module->scope.snapshot(scopeMin, scopeMax);
 		Rect b = Rect(Vec(0, 15), box.size.minus(Vec(0, 15*2)));
 		nvgBeginPath(args.vg);
-		unsigned int idx = module->idx;
-		for (int i = 0; i < SCOPE_BUFFERSIZE; i++) {
+		for (int i = 0; i < 2 * SCOPE_BUFFERSIZE; i++) {
+			int j = (i < SCOPE_BUFFERSIZE) ? i : (2 * SCOPE_BUFFERSIZE - 1 - i);
 			float x, y;
-			x = (float)i / float(SCOPE_BUFFERSIZE-1);
-			y = buf[idx++];
-			if (idx > SCOPE_BUFFERSIZE) idx = 0;
+			x = (float)j / float(SCOPE_BUFFERSIZE-1);
+			y = (i < SCOPE_BUFFERSIZE) ? scopeMax[j] : scopeMin[j];
 			Vec p;
 			p.x = b.pos.x + b.size.x * x;
 			p.y = impactY + y * 10.f;
@@ -206,8 +343,71 @@ struct nActiveOscMenuItem : MenuItem {
 	AModal *module;
 	unsigned int nOsc;
 	void onAction(const event::Action &e) override{
-		module->nActiveOsc = nOsc;
+		module->onNActiveOscChange(nOsc);
 	}
 
 };
 
+/* Context Menu Item for the synthesis engine */
+struct engineMenuItem : MenuItem {
+	AModal *module;
+	unsigned int engine;
+	void onAction(const event::Action &e) override{
+		module->onEngineChange(engine);
+	}
+
+};
+
+inline void appendEngineMenu(Menu *menu, AModal *module) {
+
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Engine";
+	menu->addChild(modeLabel);
+
+	engineMenuItem *svfItem = new engineMenuItem();
+	svfItem->text = "SVF bank";
+	svfItem->module = module;
+	svfItem->engine = MODAL_SVF;
+	svfItem->rightText = CHECKMARK(module->engine == svfItem->engine);
+	menu->addChild(svfItem);
+
+	engineMenuItem *ifftItem = new engineMenuItem();
+	ifftItem->text = "IFFT additive";
+	ifftItem->module = module;
+	ifftItem->engine = MODAL_IFFT;
+	ifftItem->rightText = CHECKMARK(module->engine == ifftItem->engine);
+	menu->addChild(ifftItem);
+}
+
+/* Context Menu Item for the mode culling threshold */
+struct cullThresholdMenuItem : MenuItem {
+	AModal *module;
+	float threshold;
+	void onAction(const event::Action &e) override{
+		module->setCullThreshold(threshold);
+	}
+
+};
+
+inline void appendCullMenu(Menu *menu, AModal *module) {
+
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Mode culling";
+	menu->addChild(modeLabel);
+
+	const float thresholds[] = { 0.f, 1e-2f, 1e-3f, 1e-4f };
+	const char * labels[] = { "Off", "-60 dB", "-80 dB", "-100 dB" };
+	for (int i = 0; i < 4; i++) {
+		cullThresholdMenuItem *item = new cullThresholdMenuItem();
+		item->text = labels[i];
+		item->module = module;
+		item->threshold = thresholds[i];
+		item->rightText = CHECKMARK(module->cullThreshold == item->threshold);
+		menu->addChild(item);
+	}
+
+	MenuLabel *rateLabel = new MenuLabel();
+	rateLabel->text = "Culled modes: " + std::to_string((int)(100.f * module->skipRate + 0.5f)) + "%";
+	menu->addChild(rateLabel);
+}
+
@@ -15,41 +15,17 @@
 
 void AModalGUI::process(const ProcessArgs &args) {
 
-	bool changeValues = false;
-	float fr = pow(params[PARAM_F0].getValue(), 10.0);
-		if (f0 != fr) {
-		f0 = fr;
-		changeValues = true;
+	// parameters are read once every ctrlRate samples
+	if (ctrlCounter == 0) {
+		float fr = pow(params[PARAM_F0].getValue(), 10.0);
+		updateModes(&fr, 1, hitPoint);
 	}
-	if (inhrm != params[PARAM_INHARM].getValue()) {
-		inhrm = params[PARAM_INHARM].getValue();
-		changeValues = true;
-	}
-	if (damp != params[PARAM_DAMP].getValue()) {
-		damp = params[PARAM_DAMP].getValue();
-		changeValues = true;
-	}
-	if (dsl != params[PARAM_DAMPSLOPE].getValue()) {
-		dsl = params[PARAM_DAMPSLOPE].getValue();
-		changeValues = true;
-	}
-	dsl += hitPoint;
+	if (++ctrlCounter >= ctrlRate)
+		ctrlCounter = 0;
 
-	float mod_cv = params[PARAM_MOD_CV].getValue();
+	updateCoeffs();
 
-	if (changeValues) {
-		for (int i = 0; i < MAX_OSC; i++) {
-			float f = f0 * (float)(i+1);
-			if ((i % 2) == 1)
-				 f *= inhrm;
-			float d = damp;
-			if (dsl >= 0.0)
-				d += (i * dsl);
-			else
-				d += ((MAX_OSC-i) * (-dsl));
-			osc[i]->setCoeffs(f, d);
-		}
-	}
+	float mod_cv = params[PARAM_MOD_CV].getValue();
 
 	float in = inputs[MAIN_IN].getVoltage();
 	if (hitVelocity) {
@@ -57,22 +33,18 @@ void AModalGUI::process(const ProcessArgs &args) {
 		hitVelocity = 0.f;
 	}
 
-	float invOut, cosOut, sinOut, cumOut = 0.0;
-	for (int i = 0; i < nActiveOsc; i++) {
-		osc[i]->process(in, &invOut, &cosOut, &sinOut);
-		cumOut += sinOut;
-	}
+	float cumOut = processVoice(0, in);
+	updateSkipRate();
 
 	if (inputs[MOD1_IN].isConnected())
 		cumOut += cumOut * mod_cv * inputs[MOD1_IN].getVoltage();
 
-	cumOut = cumOut / nActiveOsc;
+	cumOut = cumOut / activeModes();
 	if (outputs[MAIN_OUT].isConnected())
 		outputs[MAIN_OUT].setVoltage(cumOut);
 
 
-	audioBuffer[idx++] = cumOut;
-	if (idx > SCOPE_BUFFERSIZE) idx = 0;
+	scope.push(cumOut);
 
 }
 
@@ -159,6 +131,16 @@ struct AModalGUIWidget : ModuleWidget {
 };
 
 
+/* Context Menu Item for the time span of the scope */
+struct scopeDecimationMenuItem : MenuItem {
+	AModalGUI *module;
+	unsigned int decimation;
+	void onAction(const event::Action &e) override{
+		module->scope.setDecimation(decimation);
+	}
+
+};
+
 void AModalGUIWidget::appendContextMenu(Menu *menu) {
 	AModalGUI *module = dynamic_cast<AModalGUI*>(this->module);
 
@@ -197,6 +179,50 @@ void AModalGUIWidget::appendContextMenu(Menu *menu) {
 	nOsc64Item->rightText = CHECKMARK(module->nActiveOsc == nOsc64Item->nOsc);
 	menu->addChild(nOsc64Item);
 
+	nActiveOscMenuItem *nOsc256Item = new nActiveOscMenuItem();
+	nOsc256Item->text = "256 (IFFT)";
+	nOsc256Item->module = module;
+	nOsc256Item->nOsc = 256;
+	nOsc256Item->rightText = CHECKMARK(module->nActiveOsc == nOsc256Item->nOsc);
+	nOsc256Item->disabled = module->engine != MODAL_IFFT;
+	menu->addChild(nOsc256Item);
+
+	nActiveOscMenuItem *nOsc1024Item = new nActiveOscMenuItem();
+	nOsc1024Item->text = "1024 (IFFT)";
+	nOsc1024Item->module = module;
+	nOsc1024Item->nOsc = 1024;
+	nOsc1024Item->rightText = CHECKMARK(module->nActiveOsc == nOsc1024Item->nOsc);
+	nOsc1024Item->disabled = module->engine != MODAL_IFFT;
+	menu->addChild(nOsc1024Item);
+
+	menu->addChild(new MenuEntry);
+
+	appendEngineMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	appendCtrlRateMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	appendCullMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *scopeLabel = new MenuLabel();
+	scopeLabel->text = "Scope window";
+	menu->addChild(scopeLabel);
+
+	const unsigned int decimations[] = { 1, 4, 16, 64 };
+	for (int i = 0; i < 4; i++) {
+		scopeDecimationMenuItem *item = new scopeDecimationMenuItem();
+		item->text = std::to_string(SCOPE_BUFFERSIZE * decimations[i]) + " samples";
+		item->module = module;
+		item->decimation = decimations[i];
+		item->rightText = CHECKMARK(module->scope.decimation == item->decimation);
+		menu->addChild(item);
+	}
+
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
 	menu->addChild(spacerLabel2);
@@ -208,21 +234,42 @@ json_t *AModalGUI::dataToJson() {
 
 	json_t *rootJ = json_object();
 	json_object_set_new(rootJ, JSON_NOSC_KEY, json_integer(nActiveOsc));
+	json_object_set_new(rootJ, JSON_CTRLRATE_KEY, json_integer(ctrlRate));
+	json_object_set_new(rootJ, JSON_CULL_KEY, json_real(cullThreshold));
+	json_object_set_new(rootJ, JSON_ENGINE_KEY, json_integer(engine));
 	json_object_set_new(rootJ, JSON_XCOORD_KEY, json_real(hitPoint));
+	json_object_set_new(rootJ, JSON_SCOPEDEC_KEY, json_integer(scope.decimation));
 	return rootJ;
 }
 
 void AModalGUI::dataFromJson(json_t *rootJ) {
 
+	json_t *ctrlRateJ = json_object_get(rootJ, JSON_CTRLRATE_KEY);
+	if (ctrlRateJ) {
+		onCtrlRateChange(json_integer_value(ctrlRateJ));
+	}
+	json_t *cullJ = json_object_get(rootJ, JSON_CULL_KEY);
+	if (cullJ) {
+		setCullThreshold(json_number_value(cullJ));
+	}
+	json_t *engineJ = json_object_get(rootJ, JSON_ENGINE_KEY);
+	if (engineJ) {
+		onEngineChange(json_integer_value(engineJ));
+	}
+	// after the engine, that sets the range
 	json_t *nOscJ = json_object_get(rootJ, JSON_NOSC_KEY);
 	if (nOscJ) {
-		nActiveOsc = json_integer_value(nOscJ);
+		onNActiveOscChange(json_integer_value(nOscJ));
 	}
 	json_t *xcoorJ = json_object_get(rootJ, JSON_XCOORD_KEY);
 	if (xcoorJ) {
 		hitPoint = json_number_value(xcoorJ);
 		hitPointChanged = true;
 	}
+	json_t *scopeDecJ = json_object_get(rootJ, JSON_SCOPEDEC_KEY);
+	if (scopeDecJ) {
+		scope.setDecimation(json_integer_value(scopeDecJ));
+	}
 }
 
 
@@ -11,11 +11,11 @@
  *-----------------------------------------------------------------*/
 
 #include "ABC.hpp"
-#include "DPW.hpp"
+#include "OscSelector.hpp"
 
 using namespace::dsp;
 
-#define DPWOSC_TYPE double
+#define DPWOSC_TYPE simd::float_4 // 4 voices per oscillator
 #define POLYCHMAX 16
 
 
@@ -34,6 +34,8 @@ struct APolyDPWOsc : Module {
 	};
 	enum OutputIds {
 		POLY_SAW_OUT,
+		POLY_SQU_OUT,
+		POLY_TRI_OUT,
 		NUM_OUTPUTS,
 	};
 
@@ -41,8 +43,8 @@ struct APolyDPWOsc : Module {
 		NUM_LIGHTS,
 	};
 
-	DPW<T> *Osc[POLYCHMAX];
-	unsigned int dpwOrder = 1;
+	OscSelector<T> *Osc[POLYCHMAX/4];
+	unsigned int dpwOrder = 1; // DPW order, or OSC_POLYBLEP, OSC_WAVETABLE
 
 	xpander16f xpMsg[2];
 
@@ -51,8 +53,8 @@ struct APolyDPWOsc : Module {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam(PITCH_PARAM, -54.f, 54.f, 0.f, "Pitch", " Hz", std::pow(2.f, 1.f/12.f), dsp::FREQ_C4, 0.f);
 		configParam(FMOD_PARAM, 0.f, 1.f, 0.f, "Modulation");
-		for (int ch = 0; ch < POLYCHMAX; ch++)
-			Osc[ch] = new DPW<T>();
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			Osc[c] = new OscSelector<T>();
 		rightExpander.producerMessage = (xpander16f*) &xpMsg[0];
 		rightExpander.consumerMessage = (xpander16f*) &xpMsg[1];
 
@@ -61,8 +63,13 @@ struct APolyDPWOsc : Module {
 	void process(const ProcessArgs &args) override;
 
 	void onDPWOrderChange(unsigned int newdpw) {
-		for (int ch = 0; ch < POLYCHMAX; ch++)
-			dpwOrder = Osc[ch]->onDPWOrderChange(newdpw); // this function also checks the validity of the input
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			dpwOrder = Osc[c]->onEngineChange(newdpw); // this function also checks the validity of the input
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			Osc[c]->setSampleTime(e.sampleTime);
 	}
 
 };
@@ -71,31 +78,52 @@ struct APolyDPWOsc : Module {
 
 template <typename T> void APolyDPWOsc<T>::process(const ProcessArgs &args) {
 
+	bool expanderPresent = (rightExpander.module && rightExpander.module->model == modelAPolyXpander);
+
+	// only the connected waveforms are computed, the expander takes the sawtooth
+	unsigned int mask = 0;
+	if (outputs[POLY_SAW_OUT].isConnected() || expanderPresent)
+		mask |= MASK_SAW;
+	if (outputs[POLY_SQU_OUT].isConnected())
+		mask |= MASK_SQU;
+	if (outputs[POLY_TRI_OUT].isConnected())
+		mask |= MASK_TRI;
+	if (mask == 0)
+		return;
+
 	float pitchKnob = params[PITCH_PARAM].getValue();
 
 	int inChanN = clamp(inputs[POLY_VOCT_IN].getChannels(), 1, POLYCHMAX);
 
-	int ch;
-	for (ch = 0; ch < inChanN; ch++) {
+	float fmAmount = quadraticBipolar(params[FMOD_PARAM].getValue()) * 12.f;
+
+	// 4 voices at a time, one per lane
+	for (int c = 0; c < inChanN; c += 4) {
 
-		float pitchCV = 12.f * inputs[POLY_VOCT_IN].getVoltage(ch);
+		T pitchCV = 12.f * inputs[POLY_VOCT_IN].template getVoltageSimd<T>(c);
 		if (inputs[POLY_FMOD_IN].isConnected()) {
-			pitchCV += quadraticBipolar(params[FMOD_PARAM].getValue()) * 12.f * inputs[POLY_FMOD_IN].getPolyVoltage(ch);
+			pitchCV += fmAmount * inputs[POLY_FMOD_IN].template getPolyVoltageSimd<T>(c);
 		}
-		T pitch = dsp::FREQ_C4 * std::pow(2.f, (pitchKnob + pitchCV) / 12.f);
+		T pitch = dsp::FREQ_C4 * simd::pow(2.f, (pitchKnob + pitchCV) / 12.f);
 
-		Osc[ch]->setPitch(pitch);
-		T out = Osc[ch]->process();
+		T out[NUM_WAVETYPES];
+		Osc[c/4]->process(pitch, out, mask);
 
-		outputs[POLY_SAW_OUT].setVoltage(out, ch);
+		if (mask & MASK_SAW)
+			outputs[POLY_SAW_OUT].setVoltageSimd(out[TYPE_SAW], c);
+		if (mask & MASK_SQU)
+			outputs[POLY_SQU_OUT].setVoltageSimd(out[TYPE_SQU], c);
+		if (mask & MASK_TRI)
+			outputs[POLY_TRI_OUT].setVoltageSimd(out[TYPE_TRI], c);
 
 	}
-	outputs[POLY_SAW_OUT].setChannels(ch+1);
+	outputs[POLY_SAW_OUT].setChannels(inChanN);
+	outputs[POLY_SQU_OUT].setChannels(inChanN);
+	outputs[POLY_TRI_OUT].setChannels(inChanN);
 
-	bool expanderPresent = (rightExpander.module && rightExpander.module->model == modelAPolyXpander);
 	if (expanderPresent) {
 		xpander16f* wrMsg = (xpander16f*)rightExpander.producerMessage;
-		for (ch = 0; ch < POLYCHMAX; ch++) {
+		for (int ch = 0; ch < POLYCHMAX; ch++) {
 			wrMsg->outs[ch] = outputs[POLY_SAW_OUT].getVoltage(ch);
 		}
 		rightExpander.messageFlipRequested = true;
@@ -137,8 +165,18 @@ APolyDPWOscWidget::APolyDPWOscWidget(APolyDPWOsc<DPWOSC_TYPE> * module) {
 		addChild(title);
 	}
 	{
-		ATextHeading * title = new ATextHeading(Vec(15, 190));
-		title->setText("SAWTOOTH");
+		ATextLabel * title = new ATextLabel(Vec(5, 200));
+		title->setText("SAW");
+		addChild(title);
+	}
+	{
+		ATextLabel * title = new ATextLabel(Vec(5, 240));
+		title->setText("SQUARE");
+		addChild(title);
+	}
+	{
+		ATextLabel * title = new ATextLabel(Vec(5, 280));
+		title->setText("TRI");
 		addChild(title);
 	}
 
@@ -149,7 +187,9 @@ APolyDPWOscWidget::APolyDPWOscWidget(APolyDPWOsc<DPWOSC_TYPE> * module) {
 	addParam(createParam<RoundBlackKnob>(Vec(30, 40), module, APolyDPWOsc<DPWOSC_TYPE>::PITCH_PARAM));
 	addParam(createParam<RoundSmallBlackKnob>(Vec(23,140), module, APolyDPWOsc<DPWOSC_TYPE>::FMOD_PARAM));
 
-	addOutput(createOutput<PJ3410Port>(Vec(30, 230), module, APolyDPWOsc<DPWOSC_TYPE>::POLY_SAW_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 208), module, APolyDPWOsc<DPWOSC_TYPE>::POLY_SAW_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 248), module, APolyDPWOsc<DPWOSC_TYPE>::POLY_SQU_OUT));
+	addOutput(createOutput<PJ301MPort>(Vec(55, 288), module, APolyDPWOsc<DPWOSC_TYPE>::POLY_TRI_OUT));
 
 }
 
@@ -200,6 +240,20 @@ void APolyDPWOscWidget::appendContextMenu(Menu *menu) {
 	dpw4Item->rightText = CHECKMARK(module->dpwOrder == dpw4Item->dpword);
 	menu->addChild(dpw4Item);
 
+	OscPolyDPWOrderMenuItem *blepItem = new OscPolyDPWOrderMenuItem();
+	blepItem->text = "PolyBLEP";
+	blepItem->dpwosc = module;
+	blepItem->dpword = OSC_POLYBLEP;
+	blepItem->rightText = CHECKMARK(module->dpwOrder == blepItem->dpword);
+	menu->addChild(blepItem);
+
+	OscPolyDPWOrderMenuItem *wtItem = new OscPolyDPWOrderMenuItem();
+	wtItem->text = "Wavetable";
+	wtItem->dpwosc = module;
+	wtItem->dpword = OSC_WAVETABLE;
+	wtItem->rightText = CHECKMARK(module->dpwOrder == wtItem->dpword);
+	menu->addChild(wtItem);
+
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
 	menu->addChild(spacerLabel2);
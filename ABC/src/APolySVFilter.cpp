@@ -14,6 +14,7 @@
 #include "SVF.hpp"
 
 #define POLYCHMAX 16
+#define JSON_SVFTYPE_KEY "svfType"
 
 struct APolySVFilter : Module {
 	enum ParamIds {
@@ -39,51 +40,119 @@ struct APolySVFilter : Module {
 		NUM_LIGHTS,
 	};
 
-	SVF<float> * filter[POLYCHMAX];
-	float hpf, bpf, lpf;
+	PolySVF filter[POLYCHMAX/4];
+	ZDFSVF<simd::float_4> zdf[POLYCHMAX/4];
+	unsigned int svfType = SVF_CHAMBERLIN;
+	unsigned int ctrlRate = 1; // coefficients update period in samples
+	unsigned int ctrlCounter = 0;
 
 	APolySVFilter() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam(PARAM_CUTOFF, 1.f, 2.5f, 2.f, "Cutoff");
 		configParam(PARAM_DAMP, 0.000001f, 0.5f, 0.25f);
-
-		for (int ch = 0; ch < POLYCHMAX; ch++)
-			filter[ch] = new SVF<float>(100, 0.1);
 	}
 
 	void process(const ProcessArgs &args) override;
 
+	json_t *dataToJson() override;
+	void dataFromJson(json_t *rootJ) override;
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		for (int i = 0; i < POLYCHMAX/4; i++) {
+			filter[i].setSampleTime(e.sampleTime);
+			zdf[i].setSampleTime(e.sampleTime);
+		}
+	}
+
+	void onCtrlRateChange(int newRate) {
+		ctrlRate = clamp(newRate, 1, CTRLRATE_MAX);
+		ctrlCounter = 0;
+	}
+
+	void onSVFTypeChange(int newType) {
+		for (int i = 0; i < POLYCHMAX/4; i++) {
+			filter[i].reset();
+			zdf[i].reset();
+		}
+		svfType = clamp(newType, 0, NUM_SVFTYPES - 1);
+	}
+
 };
 
 void APolySVFilter::process(const ProcessArgs &args) {
 
-	float knobFc = pow(params[PARAM_CUTOFF].getValue(), 10.f);
-	float damp = params[PARAM_DAMP].getValue();
-
 	int inChanN = std::min(POLYCHMAX, inputs[POLY_IN].getChannels());
 
-	int ch;
-	for (ch = 0; ch < inChanN; ch++) {
+	bool updateCoeffs = (ctrlCounter == 0);
+	if (++ctrlCounter >= ctrlRate)
+		ctrlCounter = 0;
 
-		float fc = knobFc +
-				std::pow(rescale(inputs[POLY_CUTOFF_CV].getVoltage(ch), -10.f, 10.f, 0.f, 2.f), 10.f);
+	float knobFc = 0.f, damp = 0.f;
+	if (updateCoeffs) {
+		knobFc = pow(params[PARAM_CUTOFF].getValue(), 10.f);
+		damp = params[PARAM_DAMP].getValue();
+	}
 
-		filter[ch]->setCoeffs(fc, damp);
+	// 4 voices per iteration, one for each lane of the float_4
+	for (int ch = 0; ch < inChanN; ch += 4) {
+		simd::float_4 hpf, bpf, lpf;
+
+		if (updateCoeffs) {
+			simd::float_4 cv = (inputs[POLY_CUTOFF_CV].getVoltageSimd<simd::float_4>(ch) + 10.f) * 0.1f; // [-10, 10] -> [0, 2]
+			simd::float_4 cv2 = cv * cv;
+			simd::float_4 cv4 = cv2 * cv2;
+			simd::float_4 fc = knobFc + cv4 * cv4 * cv2; // cv^10 without calling pow()
+
+			if (svfType == SVF_ZDF) {
+				if (ctrlRate > 1)
+					zdf[ch/4].setCoeffsTarget(fc, damp, ctrlRate);
+				else
+					zdf[ch/4].setCoeffs(fc, damp);
+			} else {
+				if (ctrlRate > 1)
+					filter[ch/4].setCoeffsTarget(fc, damp, ctrlRate);
+				else
+					filter[ch/4].setCoeffs(fc, damp);
+			}
+		}
 
-		filter[ch]->process(inputs[POLY_IN].getVoltage(ch), &hpf, &bpf, &lpf);
+		if (svfType == SVF_ZDF)
+			zdf[ch/4].process(inputs[POLY_IN].getVoltageSimd<simd::float_4>(ch), &hpf, &bpf, &lpf);
+		else
+			filter[ch/4].process(inputs[POLY_IN].getVoltageSimd<simd::float_4>(ch), &hpf, &bpf, &lpf);
 
-		outputs[POLY_LPF_OUT].setVoltage(lpf, ch);
-		outputs[POLY_BPF_OUT].setVoltage(bpf, ch);
-		outputs[POLY_HPF_OUT].setVoltage(hpf, ch);
+		outputs[POLY_LPF_OUT].setVoltageSimd(lpf, ch);
+		outputs[POLY_BPF_OUT].setVoltageSimd(bpf, ch);
+		outputs[POLY_HPF_OUT].setVoltageSimd(hpf, ch);
 	}
 
-	outputs[POLY_LPF_OUT].setChannels(ch + 1);
-	outputs[POLY_BPF_OUT].setChannels(ch + 1);
-	outputs[POLY_HPF_OUT].setChannels(ch + 1);
+	outputs[POLY_LPF_OUT].setChannels(inChanN);
+	outputs[POLY_BPF_OUT].setChannels(inChanN);
+	outputs[POLY_HPF_OUT].setChannels(inChanN);
+
+}
+
+json_t *APolySVFilter::dataToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, JSON_CTRLRATE_KEY, json_integer(ctrlRate));
+	json_object_set_new(rootJ, JSON_SVFTYPE_KEY, json_integer(svfType));
 
+	return rootJ;
+}
+
+void APolySVFilter::dataFromJson(json_t *rootJ) {
+	json_t *ctrlRateJ = json_object_get(rootJ, JSON_CTRLRATE_KEY);
+	if (ctrlRateJ) {
+		onCtrlRateChange(json_integer_value(ctrlRateJ));
+	}
+	json_t *svfTypeJ = json_object_get(rootJ, JSON_SVFTYPE_KEY);
+	if (svfTypeJ) {
+		onSVFTypeChange(json_integer_value(svfTypeJ));
+	}
 }
 
 struct APolySVFilterWidget : ModuleWidget {
+	void appendContextMenu(Menu *menu) override;
 	APolySVFilterWidget(APolySVFilter * module) {
 
 		setModule(module);
@@ -143,4 +212,41 @@ struct APolySVFilterWidget : ModuleWidget {
 
 };
 
+struct PolySVFTypeMenuItem : MenuItem {
+	APolySVFilter *module;
+	unsigned int svfType;
+	void onAction(const event::Action &e) override{
+		module->onSVFTypeChange(svfType);
+	}
+};
+
+void APolySVFilterWidget::appendContextMenu(Menu *menu) {
+	APolySVFilter *module = dynamic_cast<APolySVFilter*>(this->module);
+
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Filter topology";
+	menu->addChild(modeLabel);
+
+	PolySVFTypeMenuItem *chamberlinItem = new PolySVFTypeMenuItem();
+	chamberlinItem->text = "Chamberlin";
+	chamberlinItem->module = module;
+	chamberlinItem->svfType = SVF_CHAMBERLIN;
+	chamberlinItem->rightText = CHECKMARK(module->svfType == chamberlinItem->svfType);
+	menu->addChild(chamberlinItem);
+
+	PolySVFTypeMenuItem *zdfItem = new PolySVFTypeMenuItem();
+	zdfItem->text = "Zero-delay feedback";
+	zdfItem->module = module;
+	zdfItem->svfType = SVF_ZDF;
+	zdfItem->rightText = CHECKMARK(module->svfType == zdfItem->svfType);
+	menu->addChild(zdfItem);
+
+	menu->addChild(new MenuEntry);
+
+	appendCtrlRateMenu(menu, module);
+
+}
+
 Model *modelAPolySVFilter = createModel<APolySVFilter, APolySVFilterWidget>("APolySVFilter");
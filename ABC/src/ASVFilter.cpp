@@ -12,10 +12,14 @@
 
 #include "ABC.hpp"
 #include "SVF.hpp"
+#include "Oversampled.hpp"
 
 //#define EXERCISE_2
 //#define EXERCISE_4
 
+#define JSON_SVFTYPE_KEY "svfType"
+#define SVF_PRECISION PREC_FLOAT // see Precision.hpp: the float error stays below -95 dB, even at 20 Hz
+
 struct ASVFilter : Module {
 	enum ParamIds {
 		PARAM_CUTOFF,
@@ -42,8 +46,16 @@ struct ASVFilter : Module {
 		NUM_LIGHTS,
 	};
 
-	SVF<float> * filter = new SVF<float>(100, 0.1);
-	float hpf, bpf, lpf;
+	SVF<Precision<SVF_PRECISION>::io, Precision<SVF_PRECISION>::state> * filter =
+		new SVF<Precision<SVF_PRECISION>::io, Precision<SVF_PRECISION>::state>(100, 0.1);
+	ZDFSVF<Precision<SVF_PRECISION>::io, Precision<SVF_PRECISION>::state> zdf;
+	unsigned int svfType = SVF_CHAMBERLIN;
+	Precision<SVF_PRECISION>::io hpf, bpf, lpf;
+	unsigned int ctrlRate = 1; // coefficients update period in samples
+	unsigned int ctrlCounter = 0;
+	Oversampled<Precision<SVF_PRECISION>::io, 1, NUM_OUTPUTS> ovs;
+	unsigned int ovsFactor = 1;
+	float sampleTime;
 
 	ASVFilter() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -55,33 +67,114 @@ struct ASVFilter : Module {
 	configParam(PARAM_DAMP, 0.000001f, 0.5f, 0.25f);
 
 		hpf = bpf = lpf = 0.f;
+		sampleTime = APP->engine->getSampleTime();
 	}
 
 	void process(const ProcessArgs &args) override;
 
+	json_t *dataToJson() override;
+	void dataFromJson(json_t *rootJ) override;
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		sampleTime = e.sampleTime;
+		filter->setSampleTime(sampleTime / ovsFactor);
+		zdf.setSampleTime(sampleTime / ovsFactor);
+	}
+
+	void onCtrlRateChange(int newRate) {
+		ctrlRate = clamp(newRate, 1, CTRLRATE_MAX);
+		ctrlCounter = 0;
+	}
+
+	void onOvsFactorChange(unsigned int newovsf) {
+		ovs.setFactor(newovsf);
+		ovsFactor = ovs.factor;
+		filter->setSampleTime(sampleTime / ovsFactor);
+		zdf.setSampleTime(sampleTime / ovsFactor);
+	}
+
+	void onSVFTypeChange(int newType) {
+		filter->reset();
+		zdf.reset();
+		svfType = clamp(newType, 0, NUM_SVFTYPES - 1);
+	}
+
 };
 
 void ASVFilter::process(const ProcessArgs &args) {
+
+	if (ctrlCounter == 0) {
 #ifndef EXERCISE_2
-	float fc = args.sampleRate * params[PARAM_CUTOFF].getValue();
+		float fc = args.sampleRate * params[PARAM_CUTOFF].getValue();
 #else
-	float fc = pow(params[PARAM_CUTOFF].getValue(), 10.f);
+		float fc = pow(params[PARAM_CUTOFF].getValue(), 10.f);
 #endif
 #ifdef EXERCISE_4
-	fc += pow(rescale(inputs[CUTOFF_CV].getVoltage(), -10.f, 10.f, 0.f, 2.f), 10.f);
+		fc += pow(rescale(inputs[CUTOFF_CV].getVoltage(), -10.f, 10.f, 0.f, 2.f), 10.f);
 #endif
 
- 	filter->setCoeffs(fc, params[PARAM_DAMP].getValue());
+		float damp = params[PARAM_DAMP].getValue();
+		// the filters run ovsFactor times per sample
+		if (svfType == SVF_ZDF) {
+			if (ctrlRate > 1)
+				zdf.setCoeffsTarget(fc, damp, ctrlRate * ovsFactor);
+			else
+				zdf.setCoeffs(fc, damp);
+		} else {
+			if (ctrlRate > 1)
+				filter->setCoeffsTarget(fc, damp, ctrlRate * ovsFactor);
+			else
+				filter->setCoeffs(fc, damp);
+		}
+	}
+	if (++ctrlCounter >= ctrlRate)
+		ctrlCounter = 0;
 
-	filter->process(inputs[MAIN_IN].getVoltageSum(), &hpf, &bpf, &lpf);
+	typedef Precision<SVF_PRECISION>::io T;
+	T in = inputs[MAIN_IN].getVoltageSum();
+	T out[NUM_OUTPUTS];
+	ovs.process(&in, out, [&](const T * x, T * y) {
+		if (svfType == SVF_ZDF)
+			zdf.process(x[0], &hpf, &bpf, &lpf);
+		else
+			filter->process(x[0], &hpf, &bpf, &lpf);
+		y[LPF_OUT] = lpf;
+		y[BPF_OUT] = bpf;
+		y[HPF_OUT] = hpf;
+	});
 
-	outputs[LPF_OUT].setVoltage(lpf);
-	outputs[BPF_OUT].setVoltage(bpf);
-	outputs[HPF_OUT].setVoltage(hpf);
+	outputs[LPF_OUT].setVoltage(out[LPF_OUT]);
+	outputs[BPF_OUT].setVoltage(out[BPF_OUT]);
+	outputs[HPF_OUT].setVoltage(out[HPF_OUT]);
 
 }
 
+json_t *ASVFilter::dataToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, JSON_CTRLRATE_KEY, json_integer(ctrlRate));
+	json_object_set_new(rootJ, JSON_SVFTYPE_KEY, json_integer(svfType));
+	json_object_set_new(rootJ, JSON_OVSF_KEY, json_integer(ovsFactor));
+
+	return rootJ;
+}
+
+void ASVFilter::dataFromJson(json_t *rootJ) {
+	json_t *ctrlRateJ = json_object_get(rootJ, JSON_CTRLRATE_KEY);
+	if (ctrlRateJ) {
+		onCtrlRateChange(json_integer_value(ctrlRateJ));
+	}
+	json_t *svfTypeJ = json_object_get(rootJ, JSON_SVFTYPE_KEY);
+	if (svfTypeJ) {
+		onSVFTypeChange(json_integer_value(svfTypeJ));
+	}
+	json_t *ovsfJ = json_object_get(rootJ, JSON_OVSF_KEY);
+	if (ovsfJ) {
+		onOvsFactorChange(json_integer_value(ovsfJ));
+	}
+}
+
 struct ASVFilterWidget : ModuleWidget {
+	void appendContextMenu(Menu *menu) override;
 	ASVFilterWidget(ASVFilter * module) {
 
 		setModule(module);
@@ -143,4 +236,45 @@ struct ASVFilterWidget : ModuleWidget {
 
 };
 
+struct SVFTypeMenuItem : MenuItem {
+	ASVFilter *module;
+	unsigned int svfType;
+	void onAction(const event::Action &e) override{
+		module->onSVFTypeChange(svfType);
+	}
+};
+
+void ASVFilterWidget::appendContextMenu(Menu *menu) {
+	ASVFilter *module = dynamic_cast<ASVFilter*>(this->module);
+
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *modeLabel = new MenuLabel();
+	modeLabel->text = "Filter topology";
+	menu->addChild(modeLabel);
+
+	SVFTypeMenuItem *chamberlinItem = new SVFTypeMenuItem();
+	chamberlinItem->text = "Chamberlin";
+	chamberlinItem->module = module;
+	chamberlinItem->svfType = SVF_CHAMBERLIN;
+	chamberlinItem->rightText = CHECKMARK(module->svfType == chamberlinItem->svfType);
+	menu->addChild(chamberlinItem);
+
+	SVFTypeMenuItem *zdfItem = new SVFTypeMenuItem();
+	zdfItem->text = "Zero-delay feedback";
+	zdfItem->module = module;
+	zdfItem->svfType = SVF_ZDF;
+	zdfItem->rightText = CHECKMARK(module->svfType == zdfItem->svfType);
+	menu->addChild(zdfItem);
+
+	menu->addChild(new MenuEntry);
+
+	appendCtrlRateMenu(menu, module);
+
+	menu->addChild(new MenuEntry);
+
+	appendOvsFactorMenu(menu, module);
+
+}
+
 Model *modelASVFilter = createModel<ASVFilter, ASVFilterWidget>("ASVFilter");
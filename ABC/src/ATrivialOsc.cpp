@@ -11,18 +11,14 @@
  *-----------------------------------------------------------------*/
 
 #include "ABC.hpp"
-#include "dsp/resampler.hpp"
 #include "dsp/common.hpp"
+#include "Oversampled.hpp"
+#include "Wavetable.hpp"
 
 using namespace::dsp;
 
-enum {
-	OVSF_1 = 1,
-	OVSF_2 = 2,
-	OVSF_4 = 4,
-	OVSF_8 = 8,
-	MAX_OVERSAMPLE = OVSF_8,
-};
+#define POLYCHMAX 16
+#define JSON_WAVETABLE_KEY "wavetable"
 
 struct ATrivialOsc : Module {
 	enum ParamIds {
@@ -45,75 +41,105 @@ struct ATrivialOsc : Module {
 		NUM_LIGHTS,
 	};
 
-	float saw_out[MAX_OVERSAMPLE] = {};
-	float out;
+	// 4 voices per group, one per lane
+	simd::float_4 phase[POLYCHMAX/4] = {};
 	unsigned int ovsFactor = 1;
-	Decimator<2,2> d2;
-	Decimator<4,4> d4;
-	Decimator<8,8> d8;
-	int delme = 0; unsigned long cum = 0;
+	Oversampled<simd::float_4, 0, 1> ovs[POLYCHMAX/4];
+	bool wavetable = false; // band-limited wavetable instead of the trivial sawtooth
+	WTOsc<simd::float_4> wt[POLYCHMAX/4];
 
 	ATrivialOsc() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 
 		configParam(PITCH_PARAM, -54.0, 54.0, 0.0, "Pitch", " Hz", std::pow(2.f, 1.f/12.f), dsp::FREQ_C4, 0.f);
 		configParam(FMOD_PARAM, 0.0, 1.0, 0.0, "Modulation");
-
-		out = 0.0;
 	}
 
 	void process(const ProcessArgs &args) override;
 
+	json_t *dataToJson() override;
+	void dataFromJson(json_t *rootJ) override;
+
 	void onOvsFactorChange(unsigned int newovsf) {
-		ovsFactor = newovsf;
-		memset(saw_out, 0, sizeof(saw_out));
+		for (int c = 0; c < POLYCHMAX/4; c++) {
+			ovs[c].setFactor(newovsf);
+			phase[c] = 0.f;
+		}
+		ovsFactor = ovs[0].factor;
+	}
+
+	void onWavetableChange(bool newWavetable) {
+		wavetable = newWavetable;
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			wt[c].reset();
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent &e) override {
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			wt[c].setSampleTime(e.sampleTime);
 	}
 
 };
 
 void ATrivialOsc::process(const ProcessArgs &args) {
 
+	if (!outputs[SAW_OUT].isConnected())
+		return;
+
 	float pitchKnob = params[PITCH_PARAM].getValue();
-	float pitchCV = 12.f * inputs[VOCT_IN].getVoltage();
-	if (inputs[FMOD_IN].isConnected()) {
-		pitchCV += quadraticBipolar(params[FMOD_PARAM].getValue()) * 12.f * inputs[FMOD_IN].getVoltage();
-	}
-	float pitch = dsp::FREQ_C4 * std::pow(2.f, (pitchKnob + pitchCV) / 12.f);
+	float fmAmount = quadraticBipolar(params[FMOD_PARAM].getValue()) * 12.f;
 
-	float incr = pitch / ((float)ovsFactor * args.sampleRate);
+	int inChanN = clamp(inputs[VOCT_IN].getChannels(), 1, POLYCHMAX);
 
-	if (ovsFactor > 1) {
-		saw_out[0] = saw_out[ovsFactor-1] + incr;
-		for (unsigned int i = 1; i < ovsFactor; i++) {
-			saw_out[i] = saw_out[i-1] + incr;
-			if (saw_out[i] > 1.0) saw_out[i] -= 1.0;
+	for (int c = 0; c < inChanN; c += 4) {
+
+		simd::float_4 pitchCV = 12.f * inputs[VOCT_IN].getVoltageSimd<simd::float_4>(c);
+		if (inputs[FMOD_IN].isConnected()) {
+			pitchCV += fmAmount * inputs[FMOD_IN].getPolyVoltageSimd<simd::float_4>(c);
+		}
+		simd::float_4 pitch = dsp::FREQ_C4 * simd::pow(2.f, (pitchKnob + pitchCV) / 12.f);
+
+		if (wavetable) {
+			simd::float_4 wtOut[NUM_WAVETYPES];
+			wt[c/4].setPitch(pitch);
+			wt[c/4].process(wtOut, MASK_SAW);
+			outputs[SAW_OUT].setVoltageSimd(5.f * wtOut[TYPE_SAW], c);
+			continue;
 		}
-	} else {
-		saw_out[0] += incr;
-		if (saw_out[0] > 1.0) saw_out[0] -= 1.0;
-	}
 
-	switch(ovsFactor) {
-	case OVSF_2:
-		out = d2.process(saw_out);
-		break;
-	case OVSF_4:
-		out = d4.process(saw_out);
-		break;
-	case OVSF_8:
-		out = d8.process(saw_out);
-		break;
-	case OVSF_1:
-	default:
-		out = saw_out[0];
-		break;
-	}
+		simd::float_4 incr = pitch / ((float)ovsFactor * args.sampleRate);
+		simd::float_4 & saw = phase[c/4];
 
+		simd::float_4 out;
+		ovs[c/4].process(NULL, &out, [&](const simd::float_4 * x, simd::float_4 * y) {
+			saw += incr;
+			saw = simd::ifelse(saw > 1.f, saw - 1.f, saw);
+			y[0] = saw;
+		});
 
-	if(outputs[SAW_OUT].isConnected()) {
-		outputs[SAW_OUT].setVoltage(10.f * (out - 0.5));
+		outputs[SAW_OUT].setVoltageSimd(10.f * (out - 0.5f), c);
 	}
+	outputs[SAW_OUT].setChannels(inChanN);
+
+}
+
+json_t *ATrivialOsc::dataToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, JSON_WAVETABLE_KEY, json_boolean(wavetable));
+	json_object_set_new(rootJ, JSON_OVSF_KEY, json_integer(ovsFactor));
 
+	return rootJ;
+}
+
+void ATrivialOsc::dataFromJson(json_t *rootJ) {
+	json_t *wavetableJ = json_object_get(rootJ, JSON_WAVETABLE_KEY);
+	if (wavetableJ) {
+		onWavetableChange(json_boolean_value(wavetableJ));
+	}
+	json_t *ovsfJ = json_object_get(rootJ, JSON_OVSF_KEY);
+	if (ovsfJ) {
+		onOvsFactorChange(json_integer_value(ovsfJ));
+	}
 }
 
 struct ATrivialOscWidget : ModuleWidget {
@@ -165,11 +191,11 @@ struct ATrivialOscWidget : ModuleWidget {
 
 
 
-struct OscOversamplingMenuItem : MenuItem {
+struct OscWavetableMenuItem : MenuItem {
 	ATrivialOsc *module;
-	unsigned int ovsf;
+	bool wavetable;
 	void onAction(const event::Action &e) override{
-		module->onOvsFactorChange(ovsf);
+		module->onWavetableChange(wavetable);
 	}
 };
 
@@ -179,37 +205,27 @@ void ATrivialOscWidget::appendContextMenu(Menu *menu) {
 	menu->addChild(new MenuEntry);
 
 
-	MenuLabel *modeLabel = new MenuLabel();
-	modeLabel->text = "Oversampling";
-	menu->addChild(modeLabel);
-
-	OscOversamplingMenuItem *ovsf1Item = new OscOversamplingMenuItem();
-	ovsf1Item->text = "1x";
-	ovsf1Item->module = module;
-	ovsf1Item->ovsf = OVSF_1;
-	ovsf1Item->rightText = CHECKMARK(module->ovsFactor == ovsf1Item->ovsf);
-	menu->addChild(ovsf1Item);
-
-	OscOversamplingMenuItem *ovsf2Item = new OscOversamplingMenuItem();
-	ovsf2Item->text = "2x";
-	ovsf2Item->module = module;
-	ovsf2Item->ovsf = OVSF_2;
-	ovsf2Item->rightText = CHECKMARK(module->ovsFactor == ovsf2Item->ovsf);
-	menu->addChild(ovsf2Item);
-
-	OscOversamplingMenuItem *ovsf4Item = new OscOversamplingMenuItem();
-	ovsf4Item->text = "4x";
-	ovsf4Item->module = module;
-	ovsf4Item->ovsf = OVSF_4;
-	ovsf4Item->rightText = CHECKMARK(module->ovsFactor == ovsf4Item->ovsf);
-	menu->addChild(ovsf4Item);
-
-	OscOversamplingMenuItem *ovsf8Item = new OscOversamplingMenuItem();
-	ovsf8Item->text = "8x";
-	ovsf8Item->module = module;
-	ovsf8Item->ovsf = OVSF_8;
-	ovsf8Item->rightText = CHECKMARK(module->ovsFactor == ovsf8Item->ovsf);
-	menu->addChild(ovsf8Item);
+	MenuLabel *engineLabel = new MenuLabel();
+	engineLabel->text = "Engine";
+	menu->addChild(engineLabel);
+
+	OscWavetableMenuItem *trivialItem = new OscWavetableMenuItem();
+	trivialItem->text = "Trivial";
+	trivialItem->module = module;
+	trivialItem->wavetable = false;
+	trivialItem->rightText = CHECKMARK(!module->wavetable);
+	menu->addChild(trivialItem);
+
+	OscWavetableMenuItem *wtItem = new OscWavetableMenuItem();
+	wtItem->text = "Wavetable";
+	wtItem->module = module;
+	wtItem->wavetable = true;
+	wtItem->rightText = CHECKMARK(module->wavetable);
+	menu->addChild(wtItem);
+
+	menu->addChild(new MenuEntry);
+
+	appendOvsFactorMenu(menu, module, module->wavetable);
 
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
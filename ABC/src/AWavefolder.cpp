@@ -12,15 +12,15 @@
 
 #include "ABC.hpp"
 #include "dsp/digital.hpp"
+#include "Wavefolder.hpp"
+#include "Oversampled.hpp"
 
 #define WF_THRESHOLD (0.7f)
-#define SMALL_NUMERIC_TH (1e-30f)
+#define POLYCHMAX 16
+#define JSON_STAGES_KEY "stages"
+#define JSON_SHAPE_KEY "shape"
 #define EXERCISE_2
 
-template <typename T> int inline sign(T val) {
-    return (T(0) < val) - (val < T(0));
-}
-
 struct AWavefolder : Module {
 	enum ParamIds {
 		PARAM_GAIN,
@@ -46,67 +46,115 @@ struct AWavefolder : Module {
 		NUM_LIGHTS,
 	};
 
-	double mu, musqr;
-	double Fn1, xn1;
+	// 4 voices per folder, one per lane. The ADAA quotient needs the float threshold of
+	// ADAAPrecision, which keeps the error below -85 dB
+	typedef simd::float_4 T;
+	ADAAFolderCascade<T> folder[POLYCHMAX/4];
+	int stages = 1; // folders in cascade
+	int shape = SHAPE_TRIANGLE;
 	bool antialias = true;
+	Oversampled<T> ovs[POLYCHMAX/4];
+	unsigned int ovsFactor = 1;
 
 	AWavefolder() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			folder[c].setThreshold(5.f * WF_THRESHOLD);
 		configParam(PARAM_GAIN_CV, 0.0, 1.0, 0.0, "Gain CV Amount");
 		configParam(PARAM_OFFSET_CV, 0.0, 1.0, 0.0, "Offset CV Amount");
 		configParam(PARAM_GAIN, 0.1, 3.0, 1.0, "Input Gain");
 		configParam(PARAM_OFFSET, -5.0, 5.0, 0.0, "Input Offset");
-		mu = 5.0 * WF_THRESHOLD;
-		musqr = mu*mu;
-		Fn1 = xn1 = 0.0;
 	}
 
 	void setAntialiasing(bool onOff) {
 		antialias = onOff;
 	}
 
+	void onShapeChange(int newShape) {
+		shape = clamp(newShape, 0, NUM_SHAPES - 1);
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			folder[c].setShape(shaperBank.get(shape));
+	}
+
+	void onStagesChange(int newStages) {
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			folder[c].setStages(newStages);
+		stages = folder[0].stages;
+	}
+
+	void onOvsFactorChange(unsigned int newovsf) {
+		for (int c = 0; c < POLYCHMAX/4; c++)
+			ovs[c].setFactor(newovsf);
+		ovsFactor = ovs[0].factor;
+	}
+
 	void process(const ProcessArgs &args) override;
 
+	json_t *dataToJson() override;
+	void dataFromJson(json_t *rootJ) override;
+
 };
 
 void AWavefolder::process(const ProcessArgs &args) {
 
-	double offset =  params[PARAM_OFFSET_CV].getValue() * inputs[OFFSET_IN].getVoltage() / 10.0 + params[PARAM_OFFSET].getValue();
-	double gain = params[PARAM_GAIN_CV].getValue() * inputs[GAIN_IN].getVoltage() / 10.0 + params[PARAM_GAIN].getValue();
-	double out, x, z;
+	if (!outputs[MAIN_OUT].isConnected())
+		return;
+
+	int inChanN = clamp(inputs[MAIN_IN].getChannels(), 1, POLYCHMAX);
+
+	float gainCV = params[PARAM_GAIN_CV].getValue() / 10.f;
+	float offsetCV = params[PARAM_OFFSET_CV].getValue() / 10.f;
 
-	x = z = out = gain * inputs[MAIN_IN].getVoltage() + offset;
+	for (int c = 0; c < inChanN; c += 4) {
 
-	if(antialias) {
-		double dif = x - xn1;
-		if (dif < SMALL_NUMERIC_TH && dif > -SMALL_NUMERIC_TH) {
-			if (x > mu || x < -mu) {
-				double avg = 0.5*(x + xn1);
-				out = (sign(avg) * 2 * mu - avg);
+		T offset = offsetCV * inputs[OFFSET_IN].getPolyVoltageSimd<T>(c) + params[PARAM_OFFSET].getValue();
+		T gain = gainCV * inputs[GAIN_IN].getPolyVoltageSimd<T>(c) + params[PARAM_GAIN].getValue();
+		T in = inputs[MAIN_IN].getVoltageSimd<T>(c);
+		T out;
+
+		// only the audio input is upsampled, gain and offset are held
+		ADAAFolderCascade<T> & f = folder[c/4];
+		ovs[c/4].process(&in, &out, [&](const T * x, T * y) {
+			T xg = gain * x[0] + offset;
+			if(antialias) {
+				y[0] = f.process(xg);
+			} else {
+				y[0] = f.fold(xg);
 			}
-		} else {
-			double F;
-			if (x > mu || x < -mu)
-				F = -0.5 * x*x + sign(x) * 2 * mu * x - (musqr);
-			else
-				F = 0.5 * x*x;
-			out = (F - Fn1) / (dif);
-			Fn1 = F;
-		}
-		xn1 = z;
-	} else {
-		if (x > mu || x < -mu)
-			out = sign(x) * 2 * mu - x;
-	}
+		});
 
 #ifdef EXERCISE_2
-	out = out * 1.f / gain;
+		out = out / gain;
 #endif
 
+		outputs[MAIN_OUT].setVoltageSimd(out, c);
+	}
+	outputs[MAIN_OUT].setChannels(inChanN);
+
+}
 
-	if (outputs[MAIN_OUT].isConnected())
-		outputs[MAIN_OUT].setVoltage(out);
+json_t *AWavefolder::dataToJson() {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, JSON_OVSF_KEY, json_integer(ovsFactor));
+	json_object_set_new(rootJ, JSON_STAGES_KEY, json_integer(stages));
+	json_object_set_new(rootJ, JSON_SHAPE_KEY, json_integer(shape));
 
+	return rootJ;
+}
+
+void AWavefolder::dataFromJson(json_t *rootJ) {
+	json_t *ovsfJ = json_object_get(rootJ, JSON_OVSF_KEY);
+	if (ovsfJ) {
+		onOvsFactorChange(json_integer_value(ovsfJ));
+	}
+	json_t *stagesJ = json_object_get(rootJ, JSON_STAGES_KEY);
+	if (stagesJ) {
+		onStagesChange(json_integer_value(stagesJ));
+	}
+	json_t *shapeJ = json_object_get(rootJ, JSON_SHAPE_KEY);
+	if (shapeJ) {
+		onShapeChange(json_integer_value(shapeJ));
+	}
 }
 
 struct AWavefolderWidget : ModuleWidget {
@@ -172,6 +220,24 @@ struct AWavefolderMenuItem : MenuItem {
 
 };
 
+struct AWavefolderStagesMenuItem : MenuItem {
+	AWavefolder *wavefolder;
+	int stages;
+	void onAction(const event::Action &e) override{
+		wavefolder->onStagesChange(stages);
+	}
+
+};
+
+struct AWavefolderShapeMenuItem : MenuItem {
+	AWavefolder *wavefolder;
+	int shape;
+	void onAction(const event::Action &e) override{
+		wavefolder->onShapeChange(shape);
+	}
+
+};
+
 void AWavefolderWidget::appendContextMenu(Menu *menu) {
 	AWavefolder *module = dynamic_cast<AWavefolder*>(this->module);
 
@@ -196,6 +262,41 @@ void AWavefolderWidget::appendContextMenu(Menu *menu) {
 	noantialiasItem2->rightText = CHECKMARK(module->antialias == noantialiasItem2->antialias);
 	menu->addChild(noantialiasItem2);
 
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *shapeLabel = new MenuLabel();
+	shapeLabel->text = "Transfer curve";
+	menu->addChild(shapeLabel);
+
+	const char * shapeNames[NUM_SHAPES] = { "Triangle fold", "Sine fold", "Tanh", "Polynomial" };
+	for (int n = 0; n < NUM_SHAPES; n++) {
+		AWavefolderShapeMenuItem *shapeItem = new AWavefolderShapeMenuItem();
+		shapeItem->text = shapeNames[n];
+		shapeItem->wavefolder = module;
+		shapeItem->shape = n;
+		shapeItem->rightText = CHECKMARK(module->shape == shapeItem->shape);
+		menu->addChild(shapeItem);
+	}
+
+	menu->addChild(new MenuEntry);
+
+	MenuLabel *stagesLabel = new MenuLabel();
+	stagesLabel->text = "Folding stages";
+	menu->addChild(stagesLabel);
+
+	for (int n = 1; n <= WF_MAX_STAGES; n++) {
+		AWavefolderStagesMenuItem *stagesItem = new AWavefolderStagesMenuItem();
+		stagesItem->text = std::to_string(n);
+		stagesItem->wavefolder = module;
+		stagesItem->stages = n;
+		stagesItem->rightText = CHECKMARK(module->stages == stagesItem->stages);
+		menu->addChild(stagesItem);
+	}
+
+	menu->addChild(new MenuEntry);
+
+	appendOvsFactorMenu(menu, module);
+
 	/* additional spacer for future content
 	MenuLabel *spacerLabel2 = new MenuLabel();
 	menu->addChild(spacerLabel2);
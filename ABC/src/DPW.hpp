@@ -10,14 +10,16 @@
  *
  *-----------------------------------------------------------------*/
 
+#pragma once
 #include "rack.hpp"
+#include "Precision.hpp"
+#include <tuple>
 
 using namespace rack;
 
 
-inline int factorial(int n) {
-	if (n > 1) return n * factorial(n-1);
-	else return 1;
+constexpr int factorial(int n) {
+	return (n > 1) ? n * factorial(n-1) : 1;
 }
 
 typedef enum {
@@ -32,124 +34,250 @@ typedef enum {
 	TYPE_SAW,
 	TYPE_SQU,
 	TYPE_TRI,
+	NUM_WAVETYPES,
 } WAVETYPE;
 
-template <typename T>
+/*
+ * One bit per WAVETYPE, to ask an oscillator for several waveforms at once
+ */
+typedef enum {
+	MASK_SAW = 1 << TYPE_SAW,
+	MASK_SQU = 1 << TYPE_SQU,
+	MASK_TRI = 1 << TYPE_TRI,
+} WAVEMASK;
+
+#define DPW_GAIN_TABLE_SIZE 128 // table intervals over f/fs in [0, 0.5]
+
+/*
+ * pi x / sin(pi x), for the normalized frequency x = f/fs in [0, 0.5], by linear interpolation
+ * in a table computed once. The relative error is below 1.9e-5.
+ */
+inline float dpwInvSinc(float x) {
+	static const struct Table {
+		float s[DPW_GAIN_TABLE_SIZE + 1];
+		Table() {
+			s[0] = 1.f;
+			for (int i = 1; i <= DPW_GAIN_TABLE_SIZE; i++) {
+				double x = 0.5 * i / DPW_GAIN_TABLE_SIZE;
+				s[i] = M_PI * x / sin(M_PI * x);
+			}
+		}
+	} table;
+
+	float p = clamp(x, 0.f, 0.5f) * (2 * DPW_GAIN_TABLE_SIZE);
+	int i = std::min((int)p, DPW_GAIN_TABLE_SIZE - 1);
+	return table.s[i] + (p - i) * (table.s[i+1] - table.s[i]);
+}
+
+/*
+ * Gain of one differentiator, pi / (2 sin(pi x)) = s(x) / 2x
+ */
+inline float dpwStageGain(float x) {
+	x = clamp(x, 1e-6f, 0.5f);
+	return dpwInvSinc(x) / (2.f * x);
+}
+
+inline simd::float_4 dpwStageGain(simd::float_4 x) {
+	x = simd::clamp(x, 1e-6f, 0.5f);
+	simd::float_4 s(dpwInvSinc(x[0]), dpwInvSinc(x[1]), dpwInvSinc(x[2]), dpwInvSinc(x[3]));
+	return s / (2.f * x);
+}
+
+/*
+ * Scalar and per-lane versions of the few branches in DPW, so that it also runs on simd::float_4.
+ * The selections use precBelow() and precSelect() of Precision.hpp
+ */
+inline bool dpwChanged(double a, double b) { return a != b; }
+inline bool dpwChanged(simd::float_4 a, simd::float_4 b) { return simd::movemask(a != b); }
+
+inline double dpwWrap(double phase) { return (phase >= 1.0) ? phase - 1.0 : phase; }
+inline simd::float_4 dpwWrap(simd::float_4 phase) { return simd::ifelse(phase >= 1.f, phase - 1.f, phase); }
+
+inline double dpwAbs(double x) { return std::fabs(x); }
+inline simd::float_4 dpwAbs(simd::float_4 x) { return simd::fabs(x); }
+
+/*
+ * Normalized frequency below which the ORDER-1 differences of the polynomial drown in rounding
+ * noise: there the oscillator falls back to the 2nd order DPW, whose aliasing is already low.
+ * In float, the noise would reach -80 dB at about 240 Hz (3rd order) and 880 Hz (4th order) at 44.1 kHz.
+ * Double never needs it.
+ */
+template <typename T> struct DPWPrecision {
+	static float minFreq(int order) { return 0.f; }
+};
+template <> struct DPWPrecision<float> {
+	static float minFreq(int order) { return (order == DPW_3) ? 0.0055f : (order == DPW_4) ? 0.02f : 0.f; }
+};
+template <> struct DPWPrecision<simd::float_4> : DPWPrecision<float> {};
+
+/*
+ * DPW polynomials of the trivial sawtooth, x in [-1, 1)
+ */
+template <int ORDER> struct DPWPoly;
+template <> struct DPWPoly<DPW_1> { template <typename T> static T eval(T x) { return x; } };
+template <> struct DPWPoly<DPW_2> { template <typename T> static T eval(T x) { return x * x; } };
+template <> struct DPWPoly<DPW_3> { template <typename T> static T eval(T x) { return x * x * x - x; } };
+template <> struct DPWPoly<DPW_4> { template <typename T> static T eval(T x) { T sqr = x * x; return sqr * sqr - 2.0 * sqr; } };
+
+/*
+ * DPW polynomials of the trivial triangle 1 - 2|x|, ax = |x|. As for the sawtooth, the (ORDER-1)-th
+ * derivative is ORDER! times the waveform, and the integration constants keep the polynomial and
+ * its first ORDER-2 derivatives continuous across the phase wrap.
+ */
+template <int ORDER> struct DPWTriPoly;
+template <> struct DPWTriPoly<DPW_1> { template <typename T> static T eval(T x, T ax) { return 1.0 - 2.0 * ax; } };
+template <> struct DPWTriPoly<DPW_2> { template <typename T> static T eval(T x, T ax) { return 2.0 * x * (1.0 - ax); } };
+template <> struct DPWTriPoly<DPW_3> { template <typename T> static T eval(T x, T ax) { return x * x * (3.0 - 2.0 * ax); } };
+template <> struct DPWTriPoly<DPW_4> { template <typename T> static T eval(T x, T ax) { T sqr = x * x; return x * (4.0 * sqr - 2.0 * sqr * ax - 2.0); } };
+
+/*
+ * Chain of N first-order differentiators, unrolled at compile time.
+ * z holds the previous input of each stage.
+ */
+template <int N> struct DPWDiff {
+	template <typename T> static T run(T x, T * z) {
+		T d = x - z[0];
+		z[0] = x;
+		return DPWDiff<N-1>::run(d, z + 1);
+	}
+};
+template <> struct DPWDiff<0> {
+	template <typename T> static T run(T x, T * z) { return x; }
+};
+
+/*
+ * DPW oscillator of a fixed order: polynomial and differentiators are resolved at compile time.
+ * The sawtooth, square and triangle share the phase and the gain: the square is the difference
+ * of two sawtooths half a period apart, the triangle has its own polynomial. Each of these
+ * differentiator chains only runs when one of its waveforms is asked for.
+ */
+template <typename T, int ORDER>
 struct DPW {
-	T pitch, phase;
-	T gain = 1.0;
-	unsigned int dpwOrder = 1;
-	WAVETYPE waveType;
-	T diffB[MAX_ORDER];
-	unsigned int dbw = 0; // diffB write index
-	int init;
+	static_assert(ORDER >= DPW_1 && ORDER <= MAX_ORDER, "DPW order out of range");
+
+	enum {
+		CHAIN_SAW,
+		CHAIN_SAW_HALF,	// sawtooth shifted by half a period, for the square
+		CHAIN_TRI,
+		NUM_CHAINS,
+	};
+
+	T pitch = 0.0, phase = 0.0;
+	T gain = 1.0; // gain of the whole differentiator chain
+	T lowGain;		// 2nd order fallback gain
+	T lowB[NUM_CHAINS], lowY[NUM_CHAINS];	// 2nd order fallback: differentiator state and last output
+	T lowFreq;			// lanes below DPWPrecision<T>::minFreq()
+	float sampleTime;
+	T diffB[NUM_CHAINS][ORDER]; // differentiators state, ORDER-1 are used
+	int init[NUM_CHAINS];
+	unsigned int active = 0; // chains that ran at the last sample
 
 	DPW() {
-		waveType = TYPE_SAW;
-		memset(diffB, 0, sizeof(T));
-		paramsCompute();
-		init = dpwOrder;
+		sampleTime = APP->engine->getSampleTime();
+		reset();
 	}
 
-	unsigned int onDPWOrderChange(unsigned int newdpw) {
-		if (newdpw > MAX_ORDER)
-			newdpw = MAX_ORDER;
-
-		dpwOrder = newdpw;
-		memset(diffB, 0, sizeof(diffB));
+	void setSampleTime(float st) {
+		sampleTime = st;
 		paramsCompute();
-		init = dpwOrder;
-		return newdpw;
 	}
 
-	/**
-	 * 	Differentiate ord-1 times
-	 */
-	T dpwDiff(int ord) {
-		ord = clamp(ord, 0, MAX_ORDER);
-
-		T tmpA[dpwOrder];
-		memset(tmpA, 0, sizeof(tmpA));
-		int dbr = (dbw - 1) % ord;
-
-		for (int i = 0; i < ord; i++) {
-			tmpA[i] = diffB[dbr--];
-			if (dbr < 0) dbr = ord - 1;
-		}
+	void reset() {
+		for (int c = 0; c < NUM_CHAINS; c++)
+			resetChain(c);
+		paramsCompute();
+	}
 
-		while(ord) {
-			for (int i = 0; i < ord-1; i++) {
-				tmpA[i] = gain * ( tmpA[i] - tmpA[i+1] );
-			}
-			ord--;
-		}
-		return tmpA[0];
+	void resetChain(int c) {
+		for (int i = 0; i < ORDER; i++)
+			diffB[c][i] = 0.0;
+		lowB[c] = lowY[c] = 0.0;
+		init[c] = ORDER - 1; // samples until the differentiators are filled
 	}
 
 	/**
-	 * Compute the polynomial and call the diff
+	 * Write the waveforms in mask to out[TYPE_SAW], out[TYPE_SQU], out[TYPE_TRI]
 	 */
-	T process() {
+	void process(T * out, unsigned int mask) {
 
-		// next step of the trivial waveform, advance phase
-		T triv = trivialStep(phase);
-		phase += pitch * APP->engine->getSampleTime();
-		if (phase >= 1.0) phase -= 1.0;
+		// trivial sawtooth in [-1, 1), advance phase
+		T x = 2.0 * phase - 1.0;
+		phase = dpwWrap(phase + pitch * sampleTime);
 
-		T sqr = triv * triv;
-		T poly;
+		unsigned int chains = 0;
+		if (mask & (MASK_SAW | MASK_SQU))
+			chains |= 1 << CHAIN_SAW;
+		if (mask & MASK_SQU)
+			chains |= 1 << CHAIN_SAW_HALF;
+		if (mask & MASK_TRI)
+			chains |= 1 << CHAIN_TRI;
 
-		switch (dpwOrder) {
-		case DPW_1:
-		default:
-			return triv;
-		case DPW_2:
-			poly = sqr;
-			break;
-		case DPW_3:
-			poly = sqr * triv - triv;
-			return poly;
-			break;
-		case DPW_4:
-			poly = sqr * sqr - 2.0 * sqr;
-			break;
+		// a chain that was idle has a stale state: restart it
+		unsigned int started = chains & ~active;
+		active = chains;
+		for (int c = 0; c < NUM_CHAINS; c++) {
+			if (started & (1 << c))
+				resetChain(c);
 		}
 
-		diffB[dbw++] = poly;
-		if (dbw >= dpwOrder) dbw = 0;
-		if (init) {
-			init--;
-			return poly;
+		T saw = 0.0;
+		if (chains & (1 << CHAIN_SAW))
+			saw = chain(CHAIN_SAW, x, DPWPoly<ORDER>::eval(x), x * x);
+		if (mask & MASK_SAW)
+			out[TYPE_SAW] = saw;
+		if (mask & MASK_SQU) {
+			T xh = x + precSelect(precBelow(x, T(0.0)), T(1.0), T(-1.0));
+			out[TYPE_SQU] = chain(CHAIN_SAW_HALF, xh, DPWPoly<ORDER>::eval(xh), xh * xh) - saw;
+		}
+		if (mask & MASK_TRI) {
+			T ax = dpwAbs(x);
+			out[TYPE_TRI] = chain(CHAIN_TRI, 1.0 - 2.0 * ax, DPWTriPoly<ORDER>::eval(x, ax), DPWTriPoly<DPW_2>::eval(x, ax));
 		}
-		return dpwDiff(dpwOrder);
 	}
 
 	/*
-	 * Generate the trivial waveform
+	 * Differentiate the polynomial ORDER-1 times. poly2 is the 2nd order polynomial, for the fallback.
+	 * While the differentiators fill up, the trivial waveform is returned.
 	 */
-	T trivialStep(int type) {
-		switch(type) {
-		case TYPE_SAW:
-			return 2 * phase - 1;
-		default:
-			return 0; // implementing other trivial waveforms is left as an exercise
+	T chain(int c, T triv, T poly, T poly2) {
+		T out = gain * DPWDiff<ORDER-1>::run(poly, diffB[c]);
+		if (ORDER > DPW_2 && DPWPrecision<T>::minFreq(ORDER) > 0.f) {
+			// delayed by (ORDER-2)/2 samples to match the group delay of the higher order
+			T y = lowGain * (poly2 - lowB[c]);
+			T low = (ORDER == DPW_3) ? 0.5 * (y + lowY[c]) : lowY[c];
+			out = precSelect(lowFreq, low, out);
+			lowB[c] = poly2;
+			lowY[c] = y;
 		}
+		if (init[c]) {
+			init[c]--;
+			return triv;
+		}
+		return out;
 	}
 
 	/*
-	 * Diff gain compute
+	 * Diff gain compute: 1/ORDER! * (pi / (2 sin(pi x)))^(ORDER-1), with x = f Ts, is computed as
+	 * (s(x) / 2x)^(ORDER-1) / ORDER! with s(x) = pi x / sin(pi x) from a table: no transcendental
+	 * functions even with audio-rate FM. The gain error is below 5.6e-5 (0.0005 dB) at order 4.
 	 */
 	void paramsCompute() {
 
-		if (dpwOrder > 1)
-			gain = std::pow(1.f / factorial(dpwOrder) * std::pow(M_PI / (2.f*sin(M_PI*pitch * APP->engine->getSampleTime())),
-					dpwOrder-1.f), 1.0 / (dpwOrder-1.f));
-		else
+		if (ORDER > 1) {
+			T x = pitch * sampleTime;
+			T g = dpwStageGain(x);
+			gain = 1.0 / factorial(ORDER);
+			for (int i = 1; i < ORDER; i++)
+				gain *= g;
+			lowGain = 0.5 * g;
+			lowFreq = precBelow(x, T(DPWPrecision<T>::minFreq(ORDER)));
+		} else {
 			gain=1.0;
+		}
 	}
 
 	void setPitch(T newPitch) {
-		if (pitch != newPitch) {
+		if (dpwChanged(pitch, newPitch)) {
 			pitch = newPitch;
 			paramsCompute();
 		}
@@ -0,0 +1,62 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#include "EnvCurve.hpp"
+
+
+EnvCurveBank envCurveBank;
+
+/*
+ * Exponential: (exp(c p) - 1) / (exp(c) - 1), c = CURVE_EXP_MAX k.
+ * S-curve: tanh(c (p - 1/2)) normalized to [0, 1], c = CURVE_S_MAX k, and for k < 0 its
+ * inverse function.
+ */
+static double curveEval(int family, double k, double p) {
+	if (std::fabs(k) < 1e-6)
+		return p;
+	if (family == CURVE_EXP) {
+		double c = CURVE_EXP_MAX * k;
+		return std::expm1(c * p) / std::expm1(c);
+	}
+	double c = CURVE_S_MAX * std::fabs(k);
+	double h = std::tanh(0.5 * c);
+	if (k > 0)
+		return 0.5 + 0.5 * std::tanh(c * (p - 0.5)) / h;
+	return 0.5 + std::atanh((2.0 * p - 1.0) * h) / c;
+}
+
+void EnvCurveBank::build() {
+	if (built)
+		return;
+
+	for (int fam = 0; fam < NUM_CURVES; fam++) {
+		for (int r = 0; r < CURVE_ROWS; r++) {
+			double k = 2.0 * r / (CURVE_ROWS - 1) - 1.0;
+			for (int i = 0; i <= CURVE_SIZE; i++)
+				table[fam][r][i] = curveEval(fam, k, (double)i / CURVE_SIZE);
+			table[fam][r][0] = 0.f;
+			table[fam][r][CURVE_SIZE] = 1.f;
+		}
+	}
+	built = true;
+}
+
+void EnvCurveBank::row(int family, float curvature, float * out) const {
+	family = clamp(family, 0, NUM_CURVES - 1);
+	float x = (clamp(curvature, -1.f, 1.f) + 1.f) * 0.5f * (CURVE_ROWS - 1);
+	int r = std::min((int)x, CURVE_ROWS - 2);
+	float fr = x - r;
+	const float * a = table[family][r];
+	const float * b = table[family][r + 1];
+	for (int i = 0; i <= CURVE_SIZE; i++)
+		out[i] = a[i] + fr * (b[i] - a[i]);
+}
@@ -0,0 +1,92 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+
+using namespace rack;
+
+#define CURVE_SIZE 512		// table intervals over the segment phase
+#define CURVE_ROWS 33		// tabulated curvatures, evenly spaced over [-1, 1]
+#define CURVE_EXP_MAX 8.f	// exponent of the sharpest exponential curve
+#define CURVE_S_MAX 6.f	// slope of the sharpest S-curve
+
+typedef enum {
+	CURVE_EXP,	// curvature < 0: fast start (logarithmic), > 0: slow start (exponential)
+	CURVE_S,	// curvature > 0: S-curve, < 0: its inverse, steep at both ends
+	NUM_CURVES,
+} CURVE;
+
+/*
+ * The progress f(p) of an envelope segment at phase p, rising from f(0) = 0 to f(1) = 1.
+ * Curvature 0 is linear in both families. Built once at plugin init and shared by all the
+ * instances.
+ */
+struct EnvCurveBank {
+	float table[NUM_CURVES][CURVE_ROWS][CURVE_SIZE + 1];
+	bool built = false;
+
+	void build();
+
+	/*
+	 * The curve of any curvature in [-1, 1], interpolated between the two closest rows
+	 */
+	void row(int family, float curvature, float * out) const;
+};
+
+extern EnvCurveBank envCurveBank;
+
+/*
+ * The curves of the SEGMENTS segments of an envelope, copied from the bank when a curvature
+ * changes. Positions are in table units, from 0 to CURVE_SIZE over the segment.
+ */
+template <int SEGMENTS>
+struct EnvCurveSet {
+	float f[SEGMENTS][CURVE_SIZE + 1];
+
+	EnvCurveSet() {
+		for (int s = 0; s < SEGMENTS; s++)
+			set(s, CURVE_EXP, 0.f);
+	}
+
+	void set(int segment, int family, float curvature) {
+		envCurveBank.row(family, curvature, f[segment]);
+	}
+
+	/*
+	 * All the rows, one after the other: the curve of a segment at i is at
+	 * segment * (CURVE_SIZE + 1) + i
+	 */
+	const float * table() const {
+		return &f[0][0];
+	}
+
+	/*
+	 * The position where the curve of a segment reaches y, to start it from a given level
+	 */
+	float inverse(int segment, float y) const {
+		const float * r = f[segment];
+		if (y <= r[0])
+			return 0.f;
+		if (y >= r[CURVE_SIZE])
+			return CURVE_SIZE;
+		int lo = 0, hi = CURVE_SIZE; // r[lo] < y <= r[hi]
+		while (hi - lo > 1) {
+			int mid = (lo + hi) / 2;
+			if (r[mid] < y)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return lo + (y - r[lo]) / (r[hi] - r[lo]);
+	}
+};
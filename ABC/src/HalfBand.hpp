@@ -0,0 +1,257 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+
+using namespace rack;
+
+#define HB_TAPS_LAST 16		// TAPS of the last 2x stage, whose transition band is the narrowest
+#define HB_TAPS_INNER 6		// TAPS of the stages before it
+#define HB_KAISER_BETA 8.f	// about -80 dB stopband
+#define HB_MAX_STAGES 4		// up to 16x
+#define HB_MAX_FACTOR (1 << HB_MAX_STAGES)
+
+/*
+ * Dot product of n taps (n multiple of 4). With float samples the taps go 4 at a time
+ * in a float_4, with float_4 samples each lane is a voice.
+ */
+inline float hbDot(const float * g, const float * x, int n) {
+	simd::float_4 acc = 0.f;
+	for (int i = 0; i < n; i += 4)
+		acc += simd::float_4::load(g + i) * simd::float_4::load(x + i);
+	return acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+template <typename T>
+inline T hbDot(const float * g, const T * x, int n) {
+	T acc = 0.f;
+	for (int i = 0; i < n; i++)
+		acc += g[i] * x[i];
+	return acc;
+}
+
+/*
+ * Number of 2x stages for a factor, rounded down to a power of 2 up to HB_MAX_FACTOR
+ */
+inline int hbStages(int factor) {
+	int s = 0;
+	while ((2 << s) <= factor && s < HB_MAX_STAGES)
+		s++;
+	return s;
+}
+
+/*
+ * Kaiser-windowed half-band lowpass of length 4 TAPS - 1. Every other tap is zero apart from
+ * the centre one (0.5): only the 2 TAPS taps g[i] = h[2i] are stored. They are computed
+ * once per TAPS and shared by all the instances.
+ */
+template <int TAPS>
+struct HalfBandKernel {
+	static const int N = 2 * TAPS;
+	alignas(16) float g[N];
+
+	static_assert(N % 4 == 0, "HalfBandKernel needs 2 TAPS to be a multiple of 4");
+
+	HalfBandKernel() {
+		const int L = 4 * TAPS - 1;
+		const int c = 2 * TAPS - 1;
+		double sum = 0.0;
+		for (int i = 0; i < N; i++) {
+			int k = 2 * i;
+			double t = 0.5 * (k - c);
+			double r = 2.0 * k / (L - 1) - 1.0;
+			double w = besselI0(HB_KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(HB_KAISER_BETA);
+			g[i] = 0.5 * std::sin(M_PI * t) / (M_PI * t) * w;
+			sum += g[i];
+		}
+		// unit gain at DC: the centre tap gives the other half
+		for (int i = 0; i < N; i++)
+			g[i] *= 0.5 / sum;
+	}
+
+	static double besselI0(double x) {
+		double s = 1.0, term = 1.0;
+		for (int k = 1; k < 32; k++) {
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			s += term;
+		}
+		return s;
+	}
+
+	static const HalfBandKernel & get() {
+		static const HalfBandKernel kernel;
+		return kernel;
+	}
+};
+
+/*
+ * 2x polyphase half-band decimator. For each pair of input samples, the odd one goes through
+ * the non-zero taps and the even one through the centre tap, a pure delay: the cost is
+ * 2 TAPS multiplications per output sample. T is float, or simd::float_4 for 4 voices.
+ */
+template <int TAPS, typename T = float>
+struct HalfBandDecimator {
+	static const int N = 2 * TAPS;
+	T odd[2 * N];		// odd input samples, newest first from odd[pos], stored twice to stay contiguous
+	T even[TAPS - 1];	// even input samples, delayed to the centre tap
+	int pos = 0, evenPos = 0;
+
+	HalfBandDecimator() {
+		reset();
+	}
+
+	void reset() {
+		std::fill(odd, odd + 2 * N, T(0.f));
+		std::fill(even, even + TAPS - 1, T(0.f));
+		pos = evenPos = 0;
+	}
+
+	/*
+	 * x0, x1: two consecutive input samples. The delay is (2 TAPS - 1) / 2 output samples.
+	 */
+	T process(T x0, T x1) {
+		pos = (pos == 0) ? N - 1 : pos - 1;
+		odd[pos] = odd[pos + N] = x1;
+
+		T centre = even[evenPos];
+		even[evenPos] = x0;
+		if (++evenPos >= TAPS - 1)
+			evenPos = 0;
+
+		return 0.5f * centre + hbDot(HalfBandKernel<TAPS>::get().g, &odd[pos], N);
+	}
+};
+
+/*
+ * Decimation by 2, 4, 8 or 16 through a cascade of half-band stages. The last stage sets
+ * the audio band and gets the longest filter, the earlier ones run at higher rates but
+ * have a wide transition band and a short filter.
+ */
+template <typename T = float>
+struct HalfBandCascade {
+	HalfBandDecimator<HB_TAPS_LAST, T> last;
+	HalfBandDecimator<HB_TAPS_INNER, T> inner[HB_MAX_STAGES - 1]; // inner[s-1] decimates 2^(s+1) to 2^s
+	int stages = 0;
+
+	/*
+	 * factor: a power of 2 up to HB_MAX_FACTOR
+	 */
+	void setFactor(int factor) {
+		int s = hbStages(factor);
+		if (s != stages) {
+			stages = s;
+			reset();
+		}
+	}
+
+	void reset() {
+		last.reset();
+		for (int s = 0; s < HB_MAX_STAGES - 1; s++)
+			inner[s].reset();
+	}
+
+	/*
+	 * in: 2^stages consecutive samples at the high rate
+	 */
+	T process(const T * in) {
+		if (stages == 0)
+			return in[0];
+
+		T buf[HB_MAX_FACTOR];
+		int n = 1 << stages;
+		std::copy(in, in + n, buf);
+		for (int s = stages - 1; s >= 1; s--) {
+			n /= 2;
+			for (int i = 0; i < n; i++)
+				buf[i] = inner[s-1].process(buf[2*i], buf[2*i+1]);
+		}
+		return last.process(buf[0], buf[1]);
+	}
+};
+
+/*
+ * 2x polyphase half-band interpolator, the dual of HalfBandDecimator: of the two output
+ * samples, the first goes through the non-zero taps and the second through the centre tap,
+ * a pure delay. The gain of 2 makes up for the zeros stuffed between the input samples.
+ */
+template <int TAPS, typename T = float>
+struct HalfBandInterpolator {
+	static const int N = 2 * TAPS;
+	T in[2 * N];	// input samples, newest first from in[pos], stored twice to stay contiguous
+	int pos = 0;
+
+	HalfBandInterpolator() {
+		reset();
+	}
+
+	void reset() {
+		std::fill(in, in + 2 * N, T(0.f));
+		pos = 0;
+	}
+
+	/*
+	 * x: one input sample, out: two output samples
+	 */
+	void process(T x, T * out) {
+		pos = (pos == 0) ? N - 1 : pos - 1;
+		in[pos] = in[pos + N] = x;
+
+		out[0] = 2.f * hbDot(HalfBandKernel<TAPS>::get().g, &in[pos], N);
+		out[1] = in[pos + TAPS - 1];
+	}
+};
+
+/*
+ * Interpolation by 2, 4, 8 or 16, the dual of HalfBandCascade: the first stage gets the
+ * long filter, the later ones the short one.
+ */
+template <typename T = float>
+struct HalfBandUpCascade {
+	HalfBandInterpolator<HB_TAPS_LAST, T> first;
+	HalfBandInterpolator<HB_TAPS_INNER, T> inner[HB_MAX_STAGES - 1]; // inner[s-1] interpolates 2^s to 2^(s+1)
+	int stages = 0;
+
+	void setFactor(int factor) {
+		int s = hbStages(factor);
+		if (s != stages) {
+			stages = s;
+			reset();
+		}
+	}
+
+	void reset() {
+		first.reset();
+		for (int s = 0; s < HB_MAX_STAGES - 1; s++)
+			inner[s].reset();
+	}
+
+	/*
+	 * in: one sample, out: 2^stages consecutive samples at the high rate
+	 */
+	void process(T in, T * out) {
+		if (stages == 0) {
+			out[0] = in;
+			return;
+		}
+
+		T buf[HB_MAX_FACTOR / 2];
+		first.process(in, out);
+		int n = 2;
+		for (int s = 1; s < stages; s++) {
+			std::copy(out, out + n, buf);
+			for (int i = 0; i < n; i++)
+				inner[s-1].process(buf[i], &out[2*i]);
+			n *= 2;
+		}
+	}
+};
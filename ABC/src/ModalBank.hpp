@@ -0,0 +1,262 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "SVF.hpp"
+
+using namespace rack;
+
+/*
+ * A bank of SVF resonators (the same filter as SVF.hpp) laid out as
+ * contiguous arrays, so that 4 modes are processed per float_4 instruction.
+ *
+ * The coefficients live in a ModalCoeffs table and the filter state in a
+ * ModalBank, so that several voices playing the same f0 can share one table.
+ * SIZE must be a multiple of 4 and at most 64 (one bit per mode in the dirty map).
+ */
+
+/*
+ * Coefficient table. Each mode is described by its frequency ratio to f0 and its damping.
+ * Changing them (or f0) only marks the modes as dirty: the coefficients are
+ * recomputed by updateCoeffs(), 4 modes at a time, for the active modes only
+ * and for a limited number of groups per call.
+ */
+template <int SIZE>
+struct ModalCoeffs {
+	alignas(16) float phi[SIZE];
+	alignas(16) float gamma[SIZE];
+	alignas(16) float dphi[SIZE];	// per-sample increments while ramping
+	alignas(16) float dgamma[SIZE];
+	alignas(16) float ratio[SIZE];	// mode frequency / f0
+	alignas(16) float damp[SIZE];
+	int rampLeft[SIZE/4];			// one ramp per group of 4 modes
+	uint64_t dirty;					// modes whose coefficients are out of date
+	int nextGroup = 0;				// round robin position of updateCoeffs()
+	int activeGroups = 0;			// groups that were active at the last updateCoeffs()
+	bool ramping = false;			// at least one group is ramping
+	float f0, sampleTime;
+
+	static_assert(SIZE % 4 == 0 && SIZE <= 64, "ModalCoeffs SIZE must be a multiple of 4, up to 64");
+
+public:
+	ModalCoeffs() {
+		sampleTime = APP->engine->getSampleTime();
+		f0 = 0.f;
+		memset(phi, 0, sizeof(phi));
+		memset(gamma, 0, sizeof(gamma));
+		memset(dphi, 0, sizeof(dphi));
+		memset(dgamma, 0, sizeof(dgamma));
+		memset(ratio, 0, sizeof(ratio));
+		memset(damp, 0, sizeof(damp));
+		memset(rampLeft, 0, sizeof(rampLeft));
+		dirty = 0;
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		setAllDirty();
+	}
+
+	void setAllDirty() {
+		dirty = (SIZE == 64) ? ~(uint64_t)0 : (((uint64_t)1 << SIZE) - 1);
+	}
+
+	void setMode(int i, float r, float d) {
+		ratio[i] = r;
+		damp[i] = d;
+		dirty |= (uint64_t)1 << i;
+	}
+
+	/*
+	 * The mode frequencies are f0 * ratio: a new f0 rescales them all, with no need to rebuild the table
+	 */
+	void setF0(float newF0) {
+		if (newF0 == f0)
+			return;
+		f0 = newF0;
+		setAllDirty();
+	}
+
+	/*
+	 * Recompute the coefficients of the dirty modes among the first nModes, visiting at most
+	 * maxGroups groups of 4 modes. With nSteps > 1 the new values are reached by a linear ramp.
+	 * Groups that just became active are updated at once, with no ramp.
+	 */
+	void updateCoeffs(int nModes, int maxGroups, int nSteps) {
+		int nGroups = (nModes + 3) / 4;
+		for (int g = activeGroups; g < nGroups; g++) {
+			if (dirty & ((uint64_t)0xF << (4*g)))
+				updateGroup(g, 1);
+		}
+		activeGroups = nGroups;
+
+		uint64_t activeMask = (nGroups * 4 >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << (nGroups * 4)) - 1);
+		for (int n = 0; n < nGroups && (dirty & activeMask); n++) {
+			if (nextGroup >= nGroups)
+				nextGroup = 0;
+			if (dirty & ((uint64_t)0xF << (4*nextGroup))) {
+				updateGroup(nextGroup++, nSteps);
+				if (--maxGroups == 0)
+					return;
+			} else {
+				nextGroup++;
+			}
+		}
+	}
+
+	/*
+	 * Recompute all the dirty modes at once, with no ramp: for a table that a voice
+	 * just took over, whose old coefficients have nothing to do with the new f0
+	 */
+	void updateNow() {
+		for (int g = 0; g < SIZE/4; g++) {
+			if (dirty & ((uint64_t)0xF << (4*g)))
+				updateGroup(g, 1);
+		}
+	}
+
+	void updateGroup(int group, int nSteps) {
+		int i = 4 * group;
+		simd::float_4 fc = f0 * simd::float_4::load(&ratio[i]);
+		simd::float_4 p = svfPhi(fc, simd::float_4(sampleTime));
+		simd::float_4 g = simd::clamp(2.f * simd::float_4::load(&damp[i]), 0.f, 1.f);
+		if (nSteps > 1) {
+			((p - simd::float_4::load(&phi[i])) / (float)nSteps).store(&dphi[i]);
+			((g - simd::float_4::load(&gamma[i])) / (float)nSteps).store(&dgamma[i]);
+			rampLeft[group] = nSteps;
+			ramping = true;
+		} else {
+			p.store(&phi[i]);
+			g.store(&gamma[i]);
+			rampLeft[group] = 0;
+		}
+		dirty &= ~((uint64_t)0xF << i);
+	}
+
+	/*
+	 * Advance the coefficient ramps by one sample. Call once per sample, however
+	 * many voices share the table.
+	 */
+	void step(int nModes) {
+		if (!ramping)
+			return;
+		ramping = false;
+		for (int i = 0; i < nModes; i += 4) {
+			if (rampLeft[i/4] == 0)
+				continue;
+			(simd::float_4::load(&phi[i]) + simd::float_4::load(&dphi[i])).store(&phi[i]);
+			(simd::float_4::load(&gamma[i]) + simd::float_4::load(&dgamma[i])).store(&gamma[i]);
+			if (--rampLeft[i/4])
+				ramping = true;
+		}
+	}
+};
+
+/*
+ * Resonator state of one voice. Groups of modes whose energy falls below a threshold
+ * are culled: their state is cleared and they are skipped until the input wakes them up again.
+ */
+template <int SIZE>
+struct ModalBank {
+	alignas(16) float hp[SIZE];
+	alignas(16) float bp[SIZE];
+	alignas(16) float lp[SIZE];
+	uint32_t culled = 0;			// one bit per group of 4 modes
+	float cullThreshold = 0.f;		// amplitude below which a group is culled, 0 disables culling
+	unsigned int cullCounter = 0;
+
+	static const unsigned int CULL_CHECK_PERIOD = 32; // samples between two energy checks
+
+	static_assert(SIZE % 4 == 0 && SIZE <= 64, "ModalBank SIZE must be a multiple of 4, up to 64");
+
+public:
+	ModalBank() {
+		reset();
+	}
+
+	void reset() {
+		memset(hp, 0, sizeof(hp));
+		memset(bp, 0, sizeof(bp));
+		memset(lp, 0, sizeof(lp));
+		culled = 0;
+	}
+
+	void setCullThreshold(float amp) {
+		cullThreshold = amp;
+		culled = 0;
+	}
+
+	int culledModes(int nModes) {
+		int nGroups = (nModes + 3) / 4;
+		uint32_t groups = (nGroups >= 32) ? culled : (culled & ((1u << nGroups) - 1));
+		return std::min(4 * __builtin_popcount(groups), nModes);
+	}
+
+	/*
+	 * Feed xn to the first nModes resonators, using the coefficients in c, and return
+	 * the sum of their lowpass outputs. Modes beyond nModes keep their state untouched.
+	 */
+	float process(float xn, int nModes, const ModalCoeffs<SIZE> &c) {
+		// any input above the threshold is an excitation: wake all modes up
+		if (culled && fabs(xn) > cullThreshold)
+			culled = 0;
+
+		bool checkEnergy = false;
+		if (cullThreshold > 0.f && ++cullCounter >= CULL_CHECK_PERIOD) {
+			cullCounter = 0;
+			checkEnergy = true;
+		}
+
+		simd::float_4 sum = 0.f;
+		for (int i = 0; i < nModes; i += 4) {
+			if (culled & (1u << (i/4)))
+				continue;
+
+			simd::float_4 p = simd::float_4::load(&c.phi[i]);
+			simd::float_4 g = simd::float_4::load(&c.gamma[i]);
+			simd::float_4 h = simd::float_4::load(&hp[i]);
+			simd::float_4 b = simd::float_4::load(&bp[i]);
+			simd::float_4 l = simd::float_4::load(&lp[i]);
+
+			simd::float_4 bn = p*h + b;
+			simd::float_4 ln = p*bn + l;
+			simd::float_4 hn = xn - ln - g*bn;
+
+			simd::float_4 active = simd::float_4::mask();
+			if (nModes - i < 4) {
+				// last, partially active group: leave the inactive lanes as they are
+				active = simd::float_4(i, i+1, i+2, i+3) < (float)nModes;
+				bn = simd::ifelse(active, bn, b);
+				ln = simd::ifelse(active, ln, l);
+				hn = simd::ifelse(active, hn, h);
+				sum += ln & active;
+			} else {
+				sum += ln;
+			}
+
+			if (checkEnergy) {
+				// lp and bp are close to quadrature, so lp^2 + bp^2 tracks the squared amplitude
+				simd::float_4 energy = (ln*ln + bn*bn) & active;
+				if (simd::movemask(energy > cullThreshold * cullThreshold) == 0) {
+					culled |= 1u << (i/4);
+					bn = ln = hn = 0.f;
+				}
+			}
+
+			bn.store(&bp[i]);
+			ln.store(&lp[i]);
+			hn.store(&hp[i]);
+		}
+		return sum[0] + sum[1] + sum[2] + sum[3];
+	}
+};
@@ -0,0 +1,300 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "dsp/fft.hpp"
+#include "SVF.hpp"
+
+using namespace rack;
+
+/*
+ * Additive modal synthesis by inverse FFT and overlap-add (Rodet and Depalle's FFT^-1).
+ *
+ * Each mode is a decaying complex phasor z, advanced once per hop. Every hop:
+ * - the last HOP input samples are transformed, and each mode picks the input spectrum
+ *   at its own frequency as excitation;
+ * - each mode adds the spectrum of the analysis window, centered at its frequency, to a
+ *   frame spectrum (a few bins per mode);
+ * - one inverse FFT renders all modes at once. The frame is divided by the analysis window,
+ *   weighted by a triangle and overlap-added.
+ *
+ * The cost per sample grows with log(N) and with nModes / HOP, so 1024 modes are affordable.
+ * The mode amplitude is held for a frame and crossfaded between frames, so
+ * the decay is piecewise linear over one hop. An excitation is heard after at most HOP samples.
+ */
+
+#define MODALFFT_N 1024				// FFT size
+#define MODALFFT_HOP (MODALFFT_N/4)	// hop size, and length of the input blocks
+#define MODALFFT_KERNEL_HW 4		// main lobe half width of the window spectrum, in bins
+#define MODALFFT_KERNEL_OS 32		// kernel table points per bin
+#define MODALFFT_KERNEL_SIZE (2 * MODALFFT_KERNEL_HW * MODALFFT_KERNEL_OS + 2)
+
+/*
+ * 4-term Blackman-Harris window centered on n = 0, with sidelobes at -92 dB
+ */
+inline double modalFFTWindow(int n) {
+	double x = 2.0 * M_PI * n / MODALFFT_N;
+	return 0.35875 + 0.48829 * cos(x) + 0.14128 * cos(2.0 * x) + 0.01168 * cos(3.0 * x);
+}
+
+/*
+ * Main lobe of the window spectrum, sampled at MODALFFT_KERNEL_OS points per bin and
+ * scaled by 1/2 (the positive frequency half of a real sinusoid). Computed once.
+ */
+inline const float * modalFFTKernel() {
+	static const struct Kernel {
+		float table[MODALFFT_KERNEL_SIZE];
+		Kernel() {
+			for (int i = 0; i < MODALFFT_KERNEL_SIZE; i++) {
+				double d = (double)i / MODALFFT_KERNEL_OS - MODALFFT_KERNEL_HW;
+				double W = 0.0;
+				for (int n = -MODALFFT_N/2; n < MODALFFT_N/2; n++)
+					W += modalFFTWindow(n) * cos(2.0 * M_PI * d * n / MODALFFT_N);
+				table[i] = (std::fabs(d) < MODALFFT_KERNEL_HW) ? 0.5 * W : 0.f;
+			}
+		}
+	} kernel;
+	return kernel.table;
+}
+
+/*
+ * Per-hop mode coefficients for one f0. The mode table itself (ratios and dampings)
+ * is passed to update(), as it is the same for all f0.
+ */
+template <int SIZE>
+struct ModalFFTCoeffs {
+	alignas(16) float bin[SIZE];	// mode frequency, in FFT bins
+	alignas(16) float gain[SIZE];	// output gain, the same as the SVF phi
+	alignas(16) float decRe[SIZE];	// rotation and decay of the mode over one hop
+	alignas(16) float decIm[SIZE];
+	alignas(16) float excRe[SIZE];	// from the input block spectrum to the mode state
+	alignas(16) float excIm[SIZE];
+	float f0, sampleTime;
+	int nUpdated = 0;				// modes whose coefficients are up to date
+
+	static_assert(SIZE % 4 == 0, "ModalFFTCoeffs SIZE must be a multiple of 4");
+
+public:
+	ModalFFTCoeffs() {
+		sampleTime = APP->engine->getSampleTime();
+		f0 = 0.f;
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		setAllDirty();
+	}
+
+	void setAllDirty() {
+		nUpdated = 0;
+	}
+
+	void setF0(float newF0) {
+		if (newF0 == f0)
+			return;
+		f0 = newF0;
+		setAllDirty();
+	}
+
+	void update(const float *ratio, const float *damp, int nModes) {
+		if (nModes <= nUpdated)
+			return;
+
+		const float H = MODALFFT_HOP;
+		for (int i = nUpdated & ~3; i < nModes; i += 4) {
+			simd::float_4 fc = f0 * simd::float_4::load(&ratio[i]);
+			simd::float_4 d = simd::clamp(simd::float_4::load(&damp[i]), 0.f, 0.5f);
+			simd::float_4 w = 2.f * M_PI * fc * sampleTime;
+			simd::float_4 wd = w * simd::sqrt(1.f - d * d);	// damped resonance frequency
+			simd::float_4 a = d * w;						// decay per sample
+
+			(wd * (MODALFFT_N / (2.f * M_PI))).store(&bin[i]);
+			svfPhi(fc, simd::float_4(sampleTime)).store(&gain[i]);
+
+			// angles are wrapped to one turn before sin/cos
+			simd::float_4 turns = wd * (H / (2.f * M_PI));
+			simd::float_4 t = 2.f * M_PI * (turns - simd::floor(turns));
+			simd::float_4 rho = simd::exp(-a * H);
+			(rho * simd::cos(t)).store(&decRe[i]);
+			(rho * simd::sin(t)).store(&decIm[i]);
+
+			// the input block is centered on time 0 in the FFT, and its center is 1.5 HOP
+			// samples before the frame center: r^(1.5H-1), taking the decay at the block center
+			turns = wd * ((1.5f * H - 1.f) / (2.f * M_PI));
+			t = 2.f * M_PI * (turns - simd::floor(turns));
+			rho = simd::exp(-a * (1.5f * H - 1.f));
+			(rho * simd::cos(t)).store(&excRe[i]);
+			(rho * simd::sin(t)).store(&excIm[i]);
+		}
+		nUpdated = nModes;
+	}
+};
+
+/*
+ * Mode state and overlap-add buffers of one voice
+ */
+template <int SIZE>
+struct ModalFFTVoice {
+	alignas(16) float zRe[SIZE];
+	alignas(16) float zIm[SIZE];
+	alignas(16) float in[MODALFFT_HOP];
+	alignas(16) float ola[2 * MODALFFT_HOP];
+	int pos = 0;
+	int culled = 0;		// modes below the threshold at the last hop
+
+	ModalFFTVoice() {
+		reset();
+	}
+
+	void reset() {
+		memset(zRe, 0, sizeof(zRe));
+		memset(zIm, 0, sizeof(zIm));
+		memset(in, 0, sizeof(in));
+		memset(ola, 0, sizeof(ola));
+		pos = 0;
+		culled = 0;
+	}
+};
+
+/*
+ * The FFT and scratch buffers, shared by the voices of a module
+ */
+template <int SIZE>
+struct ModalFFT {
+	dsp::RealFFT fft;
+	alignas(16) float inSpec[MODALFFT_N];
+	alignas(16) float spec[MODALFFT_N];
+	alignas(16) float frame[MODALFFT_N];
+	float olaWin[2 * MODALFFT_HOP];	// triangle / analysis window, with the 1/N of the inverse FFT
+	const float * kernel;
+	float cullThreshold = 0.f;		// output amplitude below which a mode is dropped, 0 disables culling
+
+	ModalFFT() : fft(MODALFFT_N) {
+		kernel = modalFFTKernel();
+		for (int n = -MODALFFT_HOP; n < MODALFFT_HOP; n++) {
+			double tri = 1.0 - std::fabs((double)n) / MODALFFT_HOP;
+			olaWin[n + MODALFFT_HOP] = tri / (modalFFTWindow(n) * MODALFFT_N);
+		}
+	}
+
+	/*
+	 * Return the next output sample of voice v, whose modes use the coefficients in c.
+	 * Coefficients are only read once per hop, so they must be updated before every call.
+	 */
+	float process(float xn, int nModes, ModalFFTVoice<SIZE> &v, const ModalFFTCoeffs<SIZE> &c) {
+		v.in[v.pos] = xn;
+		float yn = v.ola[v.pos];
+		if (++v.pos == MODALFFT_HOP) {
+			v.pos = 0;
+			hop(nModes, v, c);
+		}
+		return yn;
+	}
+
+	/*
+	 * True when the next call to process() runs a hop
+	 */
+	static bool hopDue(const ModalFFTVoice<SIZE> &v) {
+		return v.pos == MODALFFT_HOP - 1;
+	}
+
+	void hop(int nModes, ModalFFTVoice<SIZE> &v, const ModalFFTCoeffs<SIZE> &c) {
+		const int H = MODALFFT_HOP;
+		const float maxBin = MODALFFT_N/2 - MODALFFT_KERNEL_HW;
+
+		memmove(v.ola, v.ola + H, H * sizeof(float));
+		memset(v.ola + H, 0, H * sizeof(float));
+
+		bool excited = false;
+		for (int j = 0; j < H; j++) {
+			if (std::fabs(v.in[j]) > cullThreshold) {
+				excited = true;
+				break;
+			}
+		}
+		if (excited) {
+			// the block is centered on n = 0 so that its spectrum turns slowly from bin to bin
+			memset(inSpec, 0, sizeof(inSpec));
+			memcpy(inSpec, v.in + H/2, (H/2) * sizeof(float));
+			memcpy(inSpec + MODALFFT_N - H/2, v.in, (H/2) * sizeof(float));
+			fft.rfft(inSpec, inSpec);
+			inSpec[1] = 0.f; // the Nyquist bin is packed here, the DC bin has no imaginary part
+		}
+
+		memset(spec, 0, sizeof(spec));
+		float thr2 = cullThreshold * cullThreshold;
+		bool rendered = false;
+		v.culled = 0;
+
+		for (int k = 0; k < nModes; k++) {
+			float zr = v.zRe[k] * c.decRe[k] - v.zIm[k] * c.decIm[k];
+			float zi = v.zRe[k] * c.decIm[k] + v.zIm[k] * c.decRe[k];
+			float b = c.bin[k];
+
+			if (excited && b < maxBin) {
+				// input spectrum at the mode frequency, cubic Lagrange interpolation between bins
+				int kb = (int)b;
+				float f = b - kb;
+				float cm = -f * (f - 1.f) * (f - 2.f) / 6.f;
+				float c0 = (f + 1.f) * (f - 1.f) * (f - 2.f) / 2.f;
+				float c1 = -(f + 1.f) * f * (f - 2.f) / 2.f;
+				float c2 = (f + 1.f) * f * (f - 1.f) / 6.f;
+				// bin -1 is the conjugate of bin 1
+				float xmr = kb ? inSpec[2*kb-2] : inSpec[2];
+				float xmi = kb ? inSpec[2*kb-1] : -inSpec[3];
+				float xr = cm * xmr + c0 * inSpec[2*kb] + c1 * inSpec[2*kb+2] + c2 * inSpec[2*kb+4];
+				float xi = cm * xmi + c0 * inSpec[2*kb+1] + c1 * inSpec[2*kb+3] + c2 * inSpec[2*kb+5];
+				zr += c.excRe[k] * xr - c.excIm[k] * xi;
+				zi += c.excRe[k] * xi + c.excIm[k] * xr;
+			}
+
+			float g = c.gain[k];
+			if (g * g * (zr * zr + zi * zi) <= thr2) {
+				zr = zi = 0.f;
+				v.culled++;
+			}
+			v.zRe[k] = zr;
+			v.zIm[k] = zi;
+			if ((zr == 0.f && zi == 0.f) || b >= maxBin)
+				continue;
+
+			// output g * Im(z e^jwn) = Re(A e^jwn), with A = -j g z
+			float ar = g * zi;
+			float ai = -g * zr;
+			int kb = (int)std::floor(b);
+			for (int bin = kb - MODALFFT_KERNEL_HW + 1; bin <= kb + MODALFFT_KERNEL_HW; bin++) {
+				float pos = (bin - b + MODALFFT_KERNEL_HW) * MODALFFT_KERNEL_OS;
+				int ip = (int)pos;
+				float W = kernel[ip] + (pos - ip) * (kernel[ip+1] - kernel[ip]);
+				if (bin > 0) {
+					spec[2*bin] += ar * W;
+					spec[2*bin+1] += ai * W;
+				} else if (bin < 0) {
+					// negative frequencies fold back as complex conjugates
+					spec[-2*bin] += ar * W;
+					spec[-2*bin+1] -= ai * W;
+				} else {
+					spec[0] += 2.f * ar * W;
+				}
+			}
+			rendered = true;
+		}
+
+		if (!rendered)
+			return;
+
+		fft.irfft(spec, frame);
+		for (int n = -H; n < H; n++)
+			v.ola[n + H] += frame[(n + MODALFFT_N) & (MODALFFT_N - 1)] * olaWin[n + H];
+	}
+};
@@ -0,0 +1,118 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "DPW.hpp"
+#include "PolyBLEP.hpp"
+#include "Wavetable.hpp"
+#include <tuple>
+
+using namespace rack;
+
+/*
+ * Engines following the DPW orders (DPW_1 to MAX_ORDER are engines too)
+ */
+typedef enum {
+	OSC_POLYBLEP = MAX_ORDER + 1,
+	OSC_WAVETABLE,
+	MAX_ENGINE = OSC_WAVETABLE,
+} OSCENGINE;
+
+/*
+ * One DPW oscillator per order, one PolyBLEP and one wavetable oscillator. The one in use is
+ * reached through a member function pointer, set when the engine changes, so that nothing
+ * branches on the engine per sample.
+ */
+template <typename T>
+struct OscSelector {
+	std::tuple<DPW<T, DPW_1>, DPW<T, DPW_2>, DPW<T, DPW_3>, DPW<T, DPW_4>> osc;
+	PolyBLEP<T> blep;
+	WTOsc<T> wt;
+	void (OscSelector::*tick)(T pitch, T * out, unsigned int mask);
+	unsigned int engine = DPW_1;
+
+	OscSelector() {
+		tick = &OscSelector::tickOrder<DPW_1>;
+	}
+
+	unsigned int onEngineChange(unsigned int newEngine) {
+		newEngine = clamp((int)newEngine, (int)DPW_1, (int)MAX_ENGINE);
+
+		switch (newEngine) {
+		case DPW_1:
+			select<DPW_1>();
+			break;
+		case DPW_2:
+			select<DPW_2>();
+			break;
+		case DPW_3:
+			select<DPW_3>();
+			break;
+		case DPW_4:
+			select<DPW_4>();
+			break;
+		case OSC_POLYBLEP:
+			blep.reset();
+			tick = &OscSelector::tickBlep;
+			break;
+		case OSC_WAVETABLE:
+			wt.reset();
+			tick = &OscSelector::tickWavetable;
+			break;
+		}
+		engine = newEngine;
+		return newEngine;
+	}
+
+	/*
+	 * The new oscillator is reset before it is switched in
+	 */
+	template <int ORDER> void select() {
+		DPW<T, ORDER> &o = std::get<ORDER-1>(osc);
+		o.reset();
+		tick = &OscSelector::tickOrder<ORDER>;
+	}
+
+	template <int ORDER> void tickOrder(T pitch, T * out, unsigned int mask) {
+		DPW<T, ORDER> &o = std::get<ORDER-1>(osc);
+		o.setPitch(pitch);
+		o.process(out, mask);
+	}
+
+	void tickBlep(T pitch, T * out, unsigned int mask) {
+		blep.setPitch(pitch);
+		blep.process(out, mask);
+	}
+
+	void tickWavetable(T pitch, T * out, unsigned int mask) {
+		wt.setPitch(pitch);
+		wt.process(out, mask);
+	}
+
+	/*
+	 * Write the waveforms in mask (a WAVEMASK combination) to out[TYPE_SAW], out[TYPE_SQU], out[TYPE_TRI]
+	 */
+	void process(T pitch, T * out, unsigned int mask) {
+		(this->*tick)(pitch, out, mask);
+	}
+
+	void setSampleTime(float st) {
+		std::get<0>(osc).setSampleTime(st);
+		std::get<1>(osc).setSampleTime(st);
+		std::get<2>(osc).setSampleTime(st);
+		std::get<3>(osc).setSampleTime(st);
+		blep.setSampleTime(st);
+		wt.setSampleTime(st);
+	}
+
+};
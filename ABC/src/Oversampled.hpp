@@ -0,0 +1,73 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "HalfBand.hpp"
+
+using namespace rack;
+
+/*
+ * Runs a per-sample kernel at factor times the sample rate: the NIN inputs are upsampled,
+ * the kernel is called factor times, and its NOUT outputs are decimated. Both directions
+ * use the half-band cascades of HalfBand.hpp. NIN can be 0 for generators.
+ * T is float, double or simd::float_4 (4 voices).
+ */
+template <typename T = float, int NIN = 1, int NOUT = 1>
+struct Oversampled {
+	HalfBandUpCascade<T> up[NIN > 0 ? NIN : 1];
+	HalfBandCascade<T> down[NOUT];
+	int factor = 1;
+
+	/*
+	 * newFactor: a power of 2 up to HB_MAX_FACTOR. Kernels that depend on the
+	 * sample time must be given sampleTime / factor
+	 */
+	void setFactor(int newFactor) {
+		factor = 1 << hbStages(newFactor);
+		for (int i = 0; i < NIN; i++)
+			up[i].setFactor(factor);
+		for (int o = 0; o < NOUT; o++)
+			down[o].setFactor(factor);
+	}
+
+	void reset() {
+		for (int i = 0; i < NIN; i++)
+			up[i].reset();
+		for (int o = 0; o < NOUT; o++)
+			down[o].reset();
+	}
+
+	/*
+	 * in: NIN samples, out: NOUT samples. kernel(const T * x, T * y) is called factor
+	 * times, with the NIN inputs in x and the NOUT outputs to be written in y
+	 */
+	template <typename Kernel>
+	void process(const T * in, T * out, Kernel kernel) {
+		T x[NIN > 0 ? NIN : 1][HB_MAX_FACTOR];
+		T y[NOUT][HB_MAX_FACTOR];
+		for (int i = 0; i < NIN; i++)
+			up[i].process(in[i], x[i]);
+
+		T xk[NIN > 0 ? NIN : 1], yk[NOUT];
+		for (int k = 0; k < factor; k++) {
+			for (int i = 0; i < NIN; i++)
+				xk[i] = x[i][k];
+			kernel(xk, yk);
+			for (int o = 0; o < NOUT; o++)
+				y[o][k] = yk[o];
+		}
+
+		for (int o = 0; o < NOUT; o++)
+			out[o] = down[o].process(y[o]);
+	}
+};
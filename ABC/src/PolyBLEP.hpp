@@ -0,0 +1,100 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "DPW.hpp"
+
+using namespace rack;
+
+/*
+ * PolyBLEP / PolyBLAMP oscillator: the trivial waveform is corrected around each
+ * discontinuity by a 2-sample polynomial residual, the difference between a step (or a
+ * corner, for the triangle) band-limited by a triangular kernel and the ideal one.
+ * Steps (saw, square) take the BLEP residual, corners (triangle) its integral, the BLAMP.
+ * Runs on double or, one voice per lane, on simd::float_4, like DPW.
+ */
+template <typename T>
+struct PolyBLEP {
+	T pitch = 0.0, phase = 0.0;
+	T dt = 0.0; // phase increment per sample, f Ts
+	float sampleTime;
+
+	PolyBLEP() {
+		sampleTime = APP->engine->getSampleTime();
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		dt = pitch * sampleTime;
+	}
+
+	void reset() {
+		phase = 0.0;
+	}
+
+	void setPitch(T newPitch) {
+		pitch = newPitch;
+		dt = pitch * sampleTime;
+	}
+
+	/*
+	 * Residual of a step of +2 at phase 0, seen at phase t. invDt = 1 / dt
+	 */
+	static T blep(T t, T dt, T invDt) {
+		T x = t * invDt;			// samples after the step, in [0, 1)
+		T y = (t - 1.0) * invDt;	// samples before the step, in [-1, 0)
+		T after = x + x - x * x - 1.0;
+		T before = y * y + y + y + 1.0;
+		return precSelect(precBelow(t, dt), after, precSelect(precBelow(T(1.0 - dt), t), before, T(0.0)));
+	}
+
+	/*
+	 * Residual of a unit change of slope per sample at phase 0, seen at phase t
+	 */
+	static T blamp(T t, T dt, T invDt) {
+		T x = 1.0 - t * invDt;
+		T y = 1.0 + (t - 1.0) * invDt;
+		T after = x * x * x * (1.0 / 6.0);
+		T before = y * y * y * (1.0 / 6.0);
+		return precSelect(precBelow(t, dt), after, precSelect(precBelow(T(1.0 - dt), t), before, T(0.0)));
+	}
+
+	/*
+	 * Write the waveforms in mask to out[TYPE_SAW], out[TYPE_SQU], out[TYPE_TRI], from the same phase
+	 */
+	void process(T * out, unsigned int mask) {
+		T t = phase;
+		T half = dpwWrap(t + 0.5);
+		T invDt = 1.0 / dt;
+		T firstHalf = precBelow(t, T(0.5));
+
+		if (mask & (MASK_SAW | MASK_SQU)) {
+			T b = blep(t, dt, invDt);
+			// a step of -2 at the phase wrap
+			if (mask & MASK_SAW)
+				out[TYPE_SAW] = 2.0 * t - 1.0 - b;
+			// a step of +2 at phase 0, one of -2 at phase 0.5
+			if (mask & MASK_SQU)
+				out[TYPE_SQU] = precSelect(firstHalf, T(1.0), T(-1.0)) + b - blep(half, dt, invDt);
+		}
+		if (mask & MASK_TRI) {
+			// the slope goes from -4 to +4 per cycle at phase 0 and back at phase 0.5,
+			// a change of 8 dt per sample
+			T tri = precSelect(firstHalf, T(4.0 * t - 1.0), T(3.0 - 4.0 * t));
+			out[TYPE_TRI] = tri + 8.0 * dt * (blamp(t, dt, invDt) - blamp(half, dt, invDt));
+		}
+
+		phase = dpwWrap(phase + dt);
+	}
+
+};
@@ -0,0 +1,82 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+
+using namespace rack;
+
+/*
+ * Precision policies of the DSP kernels. A kernel is templated on the type of its input and
+ * output samples, T, and on the type of its state and coefficients, S (S = T by default):
+ *  - PREC_FLOAT: float everywhere. The fastest, and 4 lanes per SIMD register instead of 2
+ *  - PREC_DOUBLE: double everywhere
+ *  - PREC_MIXED: double state with float I/O, for the kernels where rounding accumulates
+ *    (recursive filters with poles close to 1, differences of nearly equal values)
+ * Each module picks the policy of its kernels with a #define, e.g.
+ * SVF<Precision<SVF_PRECISION>::io, Precision<SVF_PRECISION>::state>
+ */
+typedef enum {
+	PREC_FLOAT,
+	PREC_DOUBLE,
+	PREC_MIXED,
+} PRECISION;
+
+template <int P> struct Precision;
+template <> struct Precision<PREC_FLOAT> { typedef float io; typedef float state; };
+template <> struct Precision<PREC_DOUBLE> { typedef double io; typedef double state; };
+template <> struct Precision<PREC_MIXED> { typedef float io; typedef double state; };
+
+/*
+ * clamp() for any state type: rack::clamp() has no double version. The comparisons compile
+ * to minss/maxss, std::fmin() and std::fmax() to library calls
+ */
+inline float precClamp(float x, float a, float b) { return (x < a) ? a : ((x > b) ? b : x); }
+inline double precClamp(double x, double a, double b) { return (x < a) ? a : ((x > b) ? b : x); }
+inline simd::float_4 precClamp(simd::float_4 x, simd::float_4 a, simd::float_4 b) { return simd::clamp(x, a, b); }
+
+/*
+ * Branchless selection for any state type. The mask of precBelow() is 1 or 0 for scalars
+ * and all-ones or zero lanes for simd::float_4, as precSelect() expects
+ */
+inline float precBelow(float x, float threshold) { return (x < threshold) ? 1.f : 0.f; }
+inline double precBelow(double x, double threshold) { return (x < threshold) ? 1.0 : 0.0; }
+inline simd::float_4 precBelow(simd::float_4 x, simd::float_4 threshold) { return x < threshold; }
+
+inline float precSelect(float mask, float a, float b) { return (mask != 0.f) ? a : b; }
+inline double precSelect(double mask, double a, double b) { return (mask != 0.0) ? a : b; }
+inline simd::float_4 precSelect(simd::float_4 mask, simd::float_4 a, simd::float_4 b) { return simd::ifelse(mask, a, b); }
+
+/*
+ * Per-lane access, for the kernels that read tables and run on float, double or simd::float_4.
+ * gather() reads table[i[l]] into lane l
+ */
+template <typename T> struct Lanes {
+	static const int N = 1;
+	static float get(const T & x, int i) { return x; }
+	static void set(T & x, int i, float v) { x = v; }
+	static T gather(const float * table, const int * i) { return table[i[0]]; }
+	static T fromInt(const int * i) { return i[0]; }
+};
+template <> struct Lanes<simd::float_4> {
+	static const int N = 4;
+	static float get(const simd::float_4 & x, int i) { return x[i]; }
+	static void set(simd::float_4 & x, int i, float v) { x[i] = v; }
+	// built from 4 scalars, not lane by lane: setting the lanes in memory and reading them
+	// back as a vector stalls the store forwarding
+	static simd::float_4 gather(const float * table, const int * i) {
+		return simd::float_4(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+	}
+	static simd::float_4 fromInt(const int * i) {
+		return simd::float_4(i[0], i[1], i[2], i[3]);
+	}
+};
@@ -11,12 +11,17 @@
  *-----------------------------------------------------------------*/
 
 #include "rack.hpp"
+#include "Precision.hpp"
 
-template <typename T>
+/*
+ * One-pole lowpass. T is the type of the input and output samples, S the type of the state
+ * and coefficient (see Precision.hpp)
+ */
+template <typename T, typename S = T>
 struct RCFilter {
-	T yn, yn1, a;
+	S yn, yn1, a;
 
-	RCFilter(T aCoeff) {
+	RCFilter(S aCoeff) {
 		this->a = aCoeff;
 		reset();
 	}
@@ -26,17 +31,24 @@ struct RCFilter {
 		reset();
 	}
 
+	/*
+	 * Coefficient of a time constant tau, in seconds
+	 */
+	static S tauToCoeff(S tau, S sampleTime) {
+		return tau / (tau + sampleTime);
+	}
+
 	void setTau(T tau) {
-		this->a = tau / (tau + APP->engine->getSampleTime());
+		this->a = tauToCoeff(S(tau), S(APP->engine->getSampleTime()));
 	}
 
 	void setCutoff(T fc) {
-		this->a = 1 - fc / APP->engine->getSampleRate();
+		this->a = 1 - S(fc) / S(APP->engine->getSampleRate());
 
 	}
 
 
-	void reset(T rstval = 0.0) {
+	void reset(S rstval = 0.0) {
 		yn = yn1 = rstval;
 	}
 
@@ -10,47 +10,267 @@
  *
  *-----------------------------------------------------------------*/
 
+#pragma once
 #include "rack.hpp"
+#include "Precision.hpp"
 
 #define EXERCISE_1
+#define SVF_FAST_PHI // comment out to compute phi with sin() (exact path)
 
 using namespace rack;
 
+/*
+ * Cutoff to phi mapping: phi = 2*sin(pi*fc*Ts), clamped to [0,1].
+ * phi reaches 1 at fc*Ts = 1/6, so the argument is clamped there and the sine
+ * is replaced by its 7th order Taylor polynomial. On [0, pi/6] the absolute
+ * error on phi is below 2e-8, i.e. under the float resolution. svfPhiExact() is the
+ * sin() version, SVF_FAST_PHI selects the one svfPhi() uses.
+ */
 template <typename T>
+inline T svfPhiFast(T fc, T sampleTime) {
+	T x = float(M_PI) * precClamp(fc * sampleTime, T(0.f), T(1.f/6.f));
+	T x2 = x * x;
+	return 2.f * x * (1.f - x2 / 6.f * (1.f - x2 / 20.f * (1.f - x2 / 42.f)));
+}
+
+template <typename T>
+inline T svfPhiExact(T fc, T sampleTime) {
+	return precClamp(T(2.f * sin(float(M_PI) * fc * sampleTime)), T(0.f), T(1.f));
+}
+
+template <typename T>
+inline T svfPhi(T fc, T sampleTime) {
+#ifdef SVF_FAST_PHI
+	return svfPhiFast(fc, sampleTime);
+#else
+	return svfPhiExact(fc, sampleTime);
+#endif
+}
+
+/*
+ * T is the type of the input and output samples, S the type of the state and coefficients
+ * (see Precision.hpp)
+ */
+template <typename T, typename S = T>
 struct SVF {
-	T hp, bp, lp, phi, gamma;
-	T fc, damp;
+	S hp, bp, lp, phi, gamma;
+	S fc, damp;
+	S sampleTime;
+	S dphi, dgamma; // per-sample increments while ramping
+	int rampLeft = 0;
 
 public:
 	SVF(T fc, T damp) {
+		sampleTime = APP->engine->getSampleTime();
+		dphi = dgamma = 0.0;
 		setCoeffs(fc, damp);
 		reset();
 	}
 
+	void setSampleTime(T st) {
+		sampleTime = st;
+		phi = svfPhi(fc, sampleTime);
+	}
+
 	void setCoeffs(T fc, T damp) {
 #ifdef EXERCISE_1
-		if (this->fc != fc || this->damp != damp) {
+		if (this->fc != fc || this->damp != damp || rampLeft) {
 #endif
+			rampLeft = 0;
 			this->fc = fc;
 			this->damp = damp;
 
-			phi = clamp( 2.0*sin(M_PI * fc * APP->engine->getSampleTime()),
-					0.f, 1.f);
+			phi = svfPhi(this->fc, sampleTime);
 
-			gamma = clamp(2.0 * damp, 0.f, 1.f);
+			gamma = precClamp(S(2.0 * damp), S(0.f), S(1.f));
 
 #ifdef EXERCISE_1
 		}
 #endif
 	}
 
+	/*
+	 * Control-rate update: the coefficients for (fc, damp) are reached linearly in nSteps samples
+	 */
+	void setCoeffsTarget(T fc, T damp, int nSteps) {
+		this->fc = fc;
+		this->damp = damp;
+
+		dphi = (svfPhi(this->fc, sampleTime) - phi) / (float)nSteps;
+		dgamma = (precClamp(S(2.0 * damp), S(0.f), S(1.f)) - gamma) / (float)nSteps;
+		rampLeft = nSteps;
+	}
+
 	void reset() {
 		hp = bp = lp = 0.0;
 	}
 
 	void process(T xn, T* hpf, T* bpf, T* lpf) {
+		if (rampLeft) {
+			phi += dphi;
+			gamma += dgamma;
+			rampLeft--;
+		}
+		bp = phi*hp + bp;
+		lp = phi*bp + lp;
+		hp = xn - lp - gamma*bp;
+		*bpf = bp;
+		*lpf = lp;
+		*hpf = hp;
+	}
+};
+
+/*
+ * Polyphonic SVF: 4 voices are processed at once, one per lane of a float_4.
+ * States and coefficients are kept in structure-of-arrays form.
+ */
+struct PolySVF {
+	simd::float_4 hp, bp, lp, phi, gamma;
+	simd::float_4 fc;
+	float damp, sampleTime;
+	simd::float_4 dphi, dgamma; // per-sample increments while ramping
+	int rampLeft = 0;
+
+public:
+	PolySVF() {
+		phi = gamma = fc = 0.f;
+		dphi = dgamma = 0.f;
+		damp = 0.f;
+		sampleTime = APP->engine->getSampleTime();
+		reset();
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		phi = svfPhi(fc, simd::float_4(sampleTime));
+	}
+
+	void setCoeffs(simd::float_4 fc, float damp) {
+		// skip the update if no lane has changed (e.g. static cutoff CV)
+		if (simd::movemask(fc != this->fc) == 0 && damp == this->damp && !rampLeft)
+			return;
+
+		rampLeft = 0;
+		this->fc = fc;
+		this->damp = damp;
+
+		phi = svfPhi(fc, simd::float_4(sampleTime));
+
+		gamma = clamp(2.f * damp, 0.f, 1.f);
+	}
+
+	/*
+	 * Control-rate update: the coefficients for (fc, damp) are reached linearly in nSteps samples
+	 */
+	void setCoeffsTarget(simd::float_4 fc, float damp, int nSteps) {
+		this->fc = fc;
+		this->damp = damp;
+
+		dphi = (svfPhi(fc, simd::float_4(sampleTime)) - phi) / (float)nSteps;
+		dgamma = (clamp(2.f * damp, 0.f, 1.f) - gamma) / (float)nSteps;
+		rampLeft = nSteps;
+	}
+
+	void reset() {
+		hp = bp = lp = 0.f;
+	}
+
+	void process(simd::float_4 xn, simd::float_4* hpf, simd::float_4* bpf, simd::float_4* lpf) {
+		if (rampLeft) {
+			phi += dphi;
+			gamma += dgamma;
+			rampLeft--;
+		}
 		bp = *bpf = phi*hp + bp;
 		lp = *lpf = phi*bp + lp;
 		hp = *hpf = xn - lp - gamma*bp;
 	}
 };
+
+typedef enum {
+	SVF_CHAMBERLIN,
+	SVF_ZDF,
+	NUM_SVFTYPES,
+} SVFTYPE;
+
+/*
+ * Zero-delay feedback (topology-preserving) SVF. The cutoff is prewarped
+ * with tan(), so it tracks up to Nyquist and stays stable without oversampling.
+ * T can be float or simd::float_4 (4 voices at once). S is the type of the state and
+ * coefficients (see Precision.hpp).
+ */
+template <typename T, typename S = T>
+struct ZDFSVF {
+	S ic1eq, ic2eq; // integrators state
+	S g, k, a1, a2, a3;
+	S fc;
+	S dg, dk; // per-sample increments while ramping
+	float sampleTime;
+	int rampLeft = 0;
+
+public:
+	ZDFSVF() {
+		sampleTime = APP->engine->getSampleTime();
+		fc = g = dg = dk = 0.f;
+		k = 1.f;
+		computeGains();
+		reset();
+	}
+
+	static S prewarp(S fc, float sampleTime) {
+		S x = float(M_PI) * precClamp(fc * sampleTime, S(0.f), S(0.49f));
+		return sin(x) / cos(x);
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		g = prewarp(fc, sampleTime);
+		computeGains();
+	}
+
+	void setCoeffs(T fc, T damp) {
+		rampLeft = 0;
+		this->fc = fc;
+		g = prewarp(this->fc, sampleTime);
+		k = precClamp(S(2.f * damp), S(0.f), S(2.f));
+		computeGains();
+	}
+
+	/*
+	 * Control-rate update: g and k are ramped linearly in nSteps samples
+	 */
+	void setCoeffsTarget(T fc, T damp, int nSteps) {
+		this->fc = fc;
+		dg = (prewarp(this->fc, sampleTime) - g) / (float)nSteps;
+		dk = (precClamp(S(2.f * damp), S(0.f), S(2.f)) - k) / (float)nSteps;
+		rampLeft = nSteps;
+	}
+
+	void computeGains() {
+		a1 = 1.f / (1.f + g * (g + k));
+		a2 = g * a1;
+		a3 = g * a2;
+	}
+
+	void reset() {
+		ic1eq = ic2eq = 0.f;
+	}
+
+	void process(T xn, T* hpf, T* bpf, T* lpf) {
+		if (rampLeft) {
+			g += dg;
+			k += dk;
+			computeGains();
+			rampLeft--;
+		}
+		S v3 = xn - ic2eq;
+		S v1 = a1 * ic1eq + a2 * v3;
+		S v2 = ic2eq + a2 * ic1eq + a3 * v3;
+		ic1eq = 2.f * v1 - ic1eq;
+		ic2eq = 2.f * v2 - ic2eq;
+
+		*bpf = v1;
+		*lpf = v2;
+		*hpf = S(xn) - k * v1 - v2;
+	}
+};
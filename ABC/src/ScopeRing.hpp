@@ -0,0 +1,88 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include <atomic>
+#include <algorithm>
+
+/*
+ * Single-producer / single-consumer ring for scope displays.
+ *
+ * The audio thread push()es samples. Every `decimation` samples it writes the min and
+ * max of that run into the ring and publishes the new write count. The UI thread
+ * snapshot()s the last SIZE pairs, oldest first. The ring holds twice as many pairs as
+ * a snapshot, so the producer can write SIZE pairs during a copy before reaching the
+ * ones being read. If it wrote more than that, the snapshot is taken again.
+ * Neither side ever waits for the other.
+ *
+ * A longer time window only raises the decimation: the UI always draws SIZE pairs.
+ */
+template <int SIZE>
+struct ScopeRing {
+	static const unsigned int CAPACITY = 2 * SIZE;
+
+	static_assert((SIZE & (SIZE - 1)) == 0, "ScopeRing SIZE must be a power of 2, so that indices survive the counter wrap");
+
+	float ringMin[CAPACITY];
+	float ringMax[CAPACITY];
+	std::atomic<unsigned int> written; // pairs written so far, wraps around
+	unsigned int decimation = 1;
+	unsigned int count = 0;
+	float runMin, runMax;
+
+	ScopeRing() : written(0) {
+		std::fill(ringMin, ringMin + CAPACITY, 0.f);
+		std::fill(ringMax, ringMax + CAPACITY, 0.f);
+		runMin = runMax = 0.f;
+	}
+
+	/* audio thread */
+	void push(float x) {
+		if (count == 0) {
+			runMin = runMax = x;
+		} else {
+			runMin = std::min(runMin, x);
+			runMax = std::max(runMax, x);
+		}
+		if (++count >= decimation) {
+			unsigned int w = written.load(std::memory_order_relaxed);
+			ringMin[w % CAPACITY] = runMin;
+			ringMax[w % CAPACITY] = runMax;
+			written.store(w + 1, std::memory_order_release);
+			count = 0;
+		}
+	}
+
+	/* UI thread. The new value is picked up by the audio thread at its next run. */
+	void setDecimation(unsigned int d) {
+		decimation = std::max(d, 1u);
+	}
+
+	/*
+	 * UI thread: copy the last SIZE min/max pairs, oldest first.
+	 * Returns false if the producer kept overrunning the copy (never at audio rates).
+	 */
+	bool snapshot(float * outMin, float * outMax) const {
+		for (int attempt = 0; attempt < 4; attempt++) {
+			unsigned int w = written.load(std::memory_order_acquire);
+			unsigned int start = w - SIZE;
+			for (int i = 0; i < SIZE; i++) {
+				outMin[i] = ringMin[(start + i) % CAPACITY];
+				outMax[i] = ringMax[(start + i) % CAPACITY];
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (written.load(std::memory_order_relaxed) - w <= CAPACITY - SIZE)
+				return true;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,34 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#include "Shaper.hpp"
+
+
+ShaperBank shaperBank;
+
+/*
+ * Sine fold: sin(u), folding back for the first time at u = pi/2.
+ * Tanh: a saturator, no folding.
+ * Polynomial: the cubic soft clipper 1.5 u - 0.5 u^3, flat beyond +/- 1.
+ */
+void ShaperBank::build() {
+	if (built)
+		return;
+
+	table[SHAPE_SINE].build([](double u) { return std::sin(u); });
+	table[SHAPE_TANH].build([](double u) { return std::tanh(u); });
+	table[SHAPE_POLY].build([](double u) {
+		double v = std::fmin(std::fmax(u, -1.0), 1.0);
+		return 1.5 * v - 0.5 * v * v * v;
+	});
+	built = true;
+}
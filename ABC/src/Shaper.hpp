@@ -0,0 +1,123 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "Precision.hpp"
+
+using namespace rack;
+
+#define SH_SIZE 2048	// table intervals
+#define SH_RANGE 16.f	// the tables span +/- SH_RANGE, in units of the fold threshold
+
+typedef enum {
+	SHAPE_TRIANGLE,	// closed form, no table
+	SHAPE_SINE,
+	SHAPE_TANH,
+	SHAPE_POLY,
+	NUM_SHAPES,
+} SHAPE;
+
+/*
+ * A transfer curve f(u) and its antiderivative F(u), F(0) = 0, sampled over +/- SH_RANGE.
+ * f is read by linear interpolation, F by cubic Hermite interpolation with f as its
+ * derivative, so that the ADAA quotient (F(u) - F(u1)) / (u - u1) stays smooth between the
+ * samples. Beyond the range f is held at the edge value and F continued with that slope.
+ */
+struct ShaperTable {
+	float f[SH_SIZE + 1];
+	float F[SH_SIZE + 1];
+
+	/*
+	 * curve: any callable double -> double, e.g. a sampled user curve
+	 */
+	template <typename Curve>
+	void build(Curve curve) {
+		const double h = 2.0 * SH_RANGE / SH_SIZE;
+		const int c = SH_SIZE / 2; // u = 0
+		for (int i = 0; i <= SH_SIZE; i++)
+			f[i] = curve(-SH_RANGE + i * h);
+		// Simpson's rule on each interval, outwards from u = 0
+		F[c] = 0.f;
+		double acc = 0.0;
+		for (int i = c; i < SH_SIZE; i++) {
+			double u = -SH_RANGE + i * h;
+			acc += h / 6.0 * (curve(u) + 4.0 * curve(u + 0.5 * h) + curve(u + h));
+			F[i+1] = acc;
+		}
+		acc = 0.0;
+		for (int i = c; i > 0; i--) {
+			double u = -SH_RANGE + i * h;
+			acc -= h / 6.0 * (curve(u - h) + 4.0 * curve(u - 0.5 * h) + curve(u));
+			F[i-1] = acc;
+		}
+	}
+
+	/*
+	 * Table position of u, clamped to the range: index of each lane, and fraction
+	 */
+	template <typename T>
+	T locate(T u, int * i) const {
+		T t = (precClamp(u, T(-SH_RANGE), T(SH_RANGE)) + SH_RANGE) * (SH_SIZE / (2.f * SH_RANGE));
+		for (int l = 0; l < Lanes<T>::N; l++)
+			i[l] = std::min((int)Lanes<T>::get(t, l), SH_SIZE - 1);
+		return t - Lanes<T>::fromInt(i);
+	}
+
+	template <typename T>
+	T curve(T u) const {
+		int i[Lanes<T>::N], i1[Lanes<T>::N];
+		T t = locate(u, i);
+		for (int l = 0; l < Lanes<T>::N; l++)
+			i1[l] = i[l] + 1;
+		T f0 = Lanes<T>::gather(f, i), f1 = Lanes<T>::gather(f, i1);
+		return f0 + t * (f1 - f0);
+	}
+
+	template <typename T>
+	T integral(T u) const {
+		const float h = 2.f * SH_RANGE / SH_SIZE;
+		int i[Lanes<T>::N], i1[Lanes<T>::N];
+		T t = locate(u, i);
+		for (int l = 0; l < Lanes<T>::N; l++)
+			i1[l] = i[l] + 1;
+		T F0 = Lanes<T>::gather(F, i), F1 = Lanes<T>::gather(F, i1);
+		T f0 = Lanes<T>::gather(f, i), f1 = Lanes<T>::gather(f, i1);
+		T t2 = t * t, t3 = t2 * t;
+		T Fu = (2.f*t3 - 3.f*t2 + 1.f) * F0 + (t3 - 2.f*t2 + t) * h * f0
+				+ (3.f*t2 - 2.f*t3) * F1 + (t3 - t2) * h * f1;
+		T edge = precClamp(u, T(-SH_RANGE), T(SH_RANGE));
+		return Fu + (u - edge) * (f0 + t * (f1 - f0));
+	}
+};
+
+/*
+ * The tables of the built-in curves, built once at plugin init and shared by all the
+ * instances. u and f are in units of the fold threshold: the curves peak at 1.
+ */
+struct ShaperBank {
+	ShaperTable table[NUM_SHAPES];
+	bool built = false;
+
+	void build();
+
+	/*
+	 * NULL for SHAPE_TRIANGLE, whose antiderivative is computed in closed form
+	 */
+	const ShaperTable * get(int shape) const {
+		if (shape <= SHAPE_TRIANGLE || shape >= NUM_SHAPES)
+			return NULL;
+		return &table[shape];
+	}
+};
+
+extern ShaperBank shaperBank;
@@ -0,0 +1,162 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "Precision.hpp"
+#include "Shaper.hpp"
+
+#define SMALL_NUMERIC_TH (1e-30f)
+
+/*
+ * Below this input difference the ADAA quotient (F(x) - F(x1)) / (x - x1) loses more to
+ * rounding than the midpoint fold loses to approximation. In float the rounding error of
+ * the quotient is about 1e-7 F / (x - x1), hence a much larger threshold.
+ */
+template <typename S> struct ADAAPrecision {
+	static S minDiff() { return SMALL_NUMERIC_TH; }
+};
+template <> struct ADAAPrecision<float> {
+	static float minDiff() { return 1e-3f; }
+};
+template <> struct ADAAPrecision<simd::float_4> {
+	static simd::float_4 minDiff() { return 1e-3f; }
+};
+
+/*
+ * Wavefolder with 1st order antiderivative antialiasing (ADAA). The input is folded back
+ * at +/- mu. T is the type of the input and output samples, S the type of the state
+ * (see Precision.hpp). There are no branches: with T = S = simd::float_4 each lane is
+ * a voice.
+ * The triangle fold and its antiderivative are computed in closed form. With a shape table
+ * (see Shaper.hpp) any other curve is read from the table instead, scaled to mu.
+ */
+template <typename T, typename S = T>
+struct ADAAFolder {
+	S mu, musqr, invMu;
+	S Fn1, xn1;
+	const ShaperTable * shape = NULL;
+
+	ADAAFolder(S threshold = 1.f) {
+		setThreshold(threshold);
+		reset();
+	}
+
+	void setThreshold(S threshold) {
+		mu = threshold;
+		musqr = mu*mu;
+		invMu = 1.f / mu;
+	}
+
+	/*
+	 * table: NULL for the triangle fold
+	 */
+	void setShape(const ShaperTable * table) {
+		shape = table;
+		reset();
+	}
+
+	void reset() {
+		Fn1 = xn1 = 0.f;
+	}
+
+	/*
+	 * Trivial folder: the excess over +/- mu is reflected back, or the shape curve
+	 */
+	S foldState(S x) {
+		if (shape)
+			return mu * shape->curve(x * invMu);
+		return x - 2.f * (x - precClamp(x, -mu, mu));
+	}
+
+	T fold(T in) {
+		return foldState(in);
+	}
+
+	/*
+	 * Antiderivative of the folder: 0.5 x^2 within +/- mu, minus the square of the excess,
+	 * or mu^2 F(x / mu) from the shape table
+	 */
+	S antiderivative(S x) {
+		if (shape)
+			return musqr * shape->integral(x * invMu);
+		S d = x - precClamp(x, -mu, mu);
+		return 0.5f * x*x - d*d;
+	}
+
+	T process(T in) {
+		S x = in;
+		S F = antiderivative(x);
+		S dif = x - xn1;
+		// ill-conditioned quotient: take the trivial fold of the midpoint instead
+		S ill = precBelow(dif*dif, ADAAPrecision<S>::minDiff() * ADAAPrecision<S>::minDiff());
+		S adaa = (F - Fn1) / precSelect(ill, S(1.f), dif);
+		S out = precSelect(ill, foldState(0.5f * (x + xn1)), adaa);
+		Fn1 = F;
+		xn1 = x;
+		return out;
+	}
+};
+
+#define WF_MAX_STAGES 8
+#define WF_STAGE_GAIN (2.f) // between stages, after clamping to +/- mu
+
+/*
+ * Cascade of up to WF_MAX_STAGES ADAA folders with the same threshold, amplified by
+ * WF_STAGE_GAIN between one stage and the next. A fold reflects only once, so its output
+ * stays within +/- mu only for inputs within +/- 3 mu: each stage output is clamped to
+ * +/- mu before the gain, and the next stage never sees more than +/- 2 mu. All the stages
+ * run in the same loop, on the same lanes, so the cost of one more stage is only the fold.
+ */
+template <typename T, typename S = T>
+struct ADAAFolderCascade {
+	ADAAFolder<T, S> stage[WF_MAX_STAGES];
+	int stages = 1;
+
+	ADAAFolderCascade(S threshold = 1.f) {
+		setThreshold(threshold);
+	}
+
+	void setThreshold(S threshold) {
+		for (int k = 0; k < WF_MAX_STAGES; k++)
+			stage[k].setThreshold(threshold);
+	}
+
+	void setShape(const ShaperTable * table) {
+		for (int k = 0; k < WF_MAX_STAGES; k++)
+			stage[k].setShape(table);
+	}
+
+	void setStages(int newStages) {
+		stages = clamp(newStages, 1, WF_MAX_STAGES);
+		reset();
+	}
+
+	void reset() {
+		for (int k = 0; k < WF_MAX_STAGES; k++)
+			stage[k].reset();
+	}
+
+	T fold(T in) {
+		S x = in;
+		for (int k = 0; k < stages - 1; k++)
+			x = WF_STAGE_GAIN * precClamp(stage[k].foldState(x), -stage[k].mu, stage[k].mu);
+		return stage[stages-1].foldState(x);
+	}
+
+	T process(T in) {
+		T x = in;
+		for (int k = 0; k < stages - 1; k++)
+			x = WF_STAGE_GAIN * precClamp(S(stage[k].process(x)), -stage[k].mu, stage[k].mu);
+		return stage[stages-1].process(x);
+	}
+};
@@ -0,0 +1,59 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#include "Wavetable.hpp"
+#include "dsp/fft.hpp"
+
+
+WavetableBank wavetableBank;
+
+/*
+ * Each level is the inverse FFT of the Fourier series of the trivial waveform, truncated
+ * to its harmonics. The amplitudes match the trivial waveforms of DPW and PolyBLEP:
+ * saw 2 phase - 1, square +1 then -1, triangle from -1 at phase 0 to +1 at phase 0.5.
+ */
+void WavetableBank::build() {
+	if (built)
+		return;
+
+	dsp::RealFFT fft(WT_SIZE);
+	alignas(16) static float spec[WT_SIZE];
+	alignas(16) static float wave[WT_SIZE]; // the rows of table are not aligned
+
+	for (int w = 0; w < NUM_WAVETYPES; w++) {
+		for (int l = 0; l < WT_LEVELS; l++) {
+			int nHarm = 1024 >> l;
+			memset(spec, 0, sizeof(spec));
+			// pffft ordering: DC, Nyquist, then re, im of each bin. The inverse is not normalized:
+			// a bin of re + i im gives 2 (re cos - im sin)
+			for (int k = 1; k <= nHarm; k++) {
+				switch (w) {
+				case TYPE_SAW:
+					spec[2*k+1] = 1.f / (M_PI * k);
+					break;
+				case TYPE_SQU:
+					if (k & 1)
+						spec[2*k+1] = -2.f / (M_PI * k);
+					break;
+				case TYPE_TRI:
+					if (k & 1)
+						spec[2*k] = -4.f / (M_PI * M_PI * k * k);
+					break;
+				}
+			}
+			fft.irfft(spec, wave);
+			memcpy(table[w][l], wave, sizeof(wave));
+			table[w][l][WT_SIZE] = wave[0];
+		}
+	}
+	built = true;
+}
@@ -0,0 +1,129 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+#pragma once
+#include "rack.hpp"
+#include "DPW.hpp"
+#include "Precision.hpp"
+
+using namespace rack;
+
+#define WT_SIZE 4096	// samples per table
+#define WT_LEVELS 11	// mip levels, one per octave
+
+/*
+ * Band-limited tables of the sawtooth, square and triangle, one mip level per octave.
+ * Level l holds the harmonics up to 1024 >> l, so that it is free of aliasing up to the
+ * normalized frequency f/fs = 2^l / 2048: level 0 serves everything below 21.5 Hz at 44.1 kHz,
+ * level 10 is a sine. The tables do not depend on the sample rate: they are built once,
+ * at plugin init, and shared by all the instances.
+ */
+struct WavetableBank {
+	float table[NUM_WAVETYPES][WT_LEVELS][WT_SIZE + 1]; // one guard sample for the interpolation
+	bool built = false;
+
+	void build();
+
+	/*
+	 * Linear interpolation in one level, at index i + frac
+	 */
+	inline float read(int wave, int level, int i, float frac) const {
+		const float * t = table[wave][level];
+		return t[i] + frac * (t[i+1] - t[i]);
+	}
+};
+
+extern WavetableBank wavetableBank;
+
+/*
+ * Wavetable oscillator. Each lane reads the level that is free of aliasing at its pitch and
+ * the next one, with fewer harmonics, and crossfades between them across the octave, so that
+ * the harmonics fade out smoothly as the pitch rises. The levels and the crossfade are
+ * recomputed only when the pitch changes: per sample a lane costs a phase increment and two
+ * interpolated table reads.
+ */
+template <typename T>
+struct WTOsc {
+	static const int N = Lanes<T>::N;
+
+	T pitch = 0.0, phase = 0.0;
+	T dt = 0.0; // phase increment per sample, f Ts
+	float sampleTime;
+	int level[N];		// first level of each lane
+	float fade[N];		// weight of the next level
+
+	WTOsc() {
+		sampleTime = APP->engine->getSampleTime();
+		paramsCompute();
+	}
+
+	void setSampleTime(float st) {
+		sampleTime = st;
+		paramsCompute();
+	}
+
+	void reset() {
+		phase = 0.0;
+	}
+
+	void setPitch(T newPitch) {
+		if (dpwChanged(pitch, newPitch)) {
+			pitch = newPitch;
+			paramsCompute();
+		}
+	}
+
+	/*
+	 * With p = log2(2048 f/fs), level l is free of aliasing for p <= l: the lane reads
+	 * level floor(p) + 1 and fades to the next one, linearly in frequency, across the octave.
+	 * frexp() gives both without a log2: 2048 f/fs = m 2^e, with m in [0.5, 1) and e = floor(p) + 1.
+	 */
+	void paramsCompute() {
+		dt = pitch * sampleTime;
+		for (int i = 0; i < N; i++) {
+			float x = Lanes<T>::get(dt, i);
+			int l;
+			float m = std::frexp(std::max(x, 1e-9f) * 2048.f, &l);
+			if (l < 0) {
+				level[i] = 0;
+				fade[i] = 0.f;
+			} else if (l >= WT_LEVELS - 1) {
+				level[i] = WT_LEVELS - 1;
+				fade[i] = 0.f;
+			} else {
+				level[i] = l;
+				fade[i] = 2.f * m - 1.f;
+			}
+		}
+	}
+
+	/*
+	 * Write the waveforms in mask to out[TYPE_SAW], out[TYPE_SQU], out[TYPE_TRI], from the same phase
+	 */
+	void process(T * out, unsigned int mask) {
+		for (int i = 0; i < N; i++) {
+			float p = Lanes<T>::get(phase, i) * WT_SIZE;
+			int idx = std::min((int)p, WT_SIZE - 1);
+			float frac = p - idx;
+			int next = level[i] + (fade[i] > 0.f);
+			for (int w = 0; w < NUM_WAVETYPES; w++) {
+				if (!(mask & (1 << w)))
+					continue;
+				float a = wavetableBank.read(w, level[i], idx, frac);
+				float b = wavetableBank.read(w, next, idx, frac);
+				Lanes<T>::set(out[w], i, a + fade[i] * (b - a));
+			}
+		}
+		phase = dpwWrap(phase + dt);
+	}
+
+};
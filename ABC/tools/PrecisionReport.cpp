@@ -0,0 +1,154 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+/*
+ * Numerical error and throughput of the precision policies of Precision.hpp, kernel by
+ * kernel. A standalone program, not part of the plugin:
+ *   make precision-report && ./precision-report
+ * Each kernel runs the same input under PREC_FLOAT and PREC_MIXED, and under PREC_DOUBLE as
+ * the reference. The error is the signal to error ratio against the reference, the cost
+ * is the average time per sample.
+ */
+
+#include "rack.hpp"
+#include "Precision.hpp"
+#include "SVF.hpp"
+#include "RCFilter.hpp"
+#include "Wavefolder.hpp"
+#include "OscSelector.hpp"
+#include <chrono>
+#include <cstdio>
+
+using namespace rack;
+
+#define REPORT_SR 48000.f
+#define REPORT_LEN 200000		// samples compared against the reference
+#define REPORT_REPEAT 10		// passes over the input for the timing
+
+static float inTab[REPORT_LEN];
+
+/*
+ * A two-tone test input: 110 Hz at 5 V and 3001 Hz at 0.5 V
+ */
+static void inputBuild() {
+	for (int i = 0; i < REPORT_LEN; i++)
+		inTab[i] = 5.f * std::sin(2.f * M_PI * 110.f * i / REPORT_SR) + 0.5f * std::sin(2.f * M_PI * 3001.f * i / REPORT_SR);
+}
+
+/*
+ * Kernels: K<P>(arg) builds the kernel under policy P, k(x) runs one sample
+ */
+template <int P> struct SVFKernel {
+	typedef typename Precision<P>::io T;
+	SVF<T, typename Precision<P>::state> f;
+	SVFKernel(float fc) : f(fc, 0.05f) {}
+	double operator()(float x) { T h, b, l; f.process(x, &h, &b, &l); return l; }
+};
+
+template <int P> struct ZDFKernel {
+	typedef typename Precision<P>::io T;
+	ZDFSVF<T, typename Precision<P>::state> f;
+	ZDFKernel(float fc) { f.setCoeffs(fc, 0.05f); }
+	double operator()(float x) { T h, b, l; f.process(x, &h, &b, &l); return l; }
+};
+
+template <int P> struct RCKernel {
+	typedef typename Precision<P>::io T;
+	typedef typename Precision<P>::state S;
+	RCFilter<T, S> f;
+	RCKernel(float tau) : f(RCFilter<T, S>::tauToCoeff(S(tau), S(1.0 / REPORT_SR))) {}
+	double operator()(float x) { return f.process(x); }
+};
+
+template <int P> struct FolderKernel {
+	typedef typename Precision<P>::io T;
+	ADAAFolder<T, typename Precision<P>::state> f;
+	FolderKernel(float threshold) : f(threshold) {}
+	double operator()(float x) { return f.process(T(1.5f * x)); }
+};
+
+// the oscillators have no state type: they run on the I/O type
+template <int P> struct OscKernel {
+	typedef typename Precision<P>::io T;
+	OscSelector<T> o;
+	OscKernel(int engine) { o.onEngineChange(engine); }
+	double operator()(float x) { T out[3]; o.process(T(55.f), out, MASK_SAW); return out[0]; }
+};
+
+template <typename K>
+double timeKernel(K & k, double * sink) {
+	double acc = 0.0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (int r = 0; r < REPORT_REPEAT; r++)
+		for (int i = 0; i < REPORT_LEN; i++)
+			acc += k(inTab[i]);
+	auto t1 = std::chrono::steady_clock::now();
+	*sink += acc;
+	return std::chrono::duration<double, std::nano>(t1 - t0).count() / (REPORT_REPEAT * REPORT_LEN);
+}
+
+/*
+ * One line per policy: the three kernels start from the same state and see the same input
+ */
+template <template <int> class K, typename A>
+void report(const char * name, A arg) {
+	K<PREC_FLOAT> f(arg);
+	K<PREC_MIXED> m(arg);
+	K<PREC_DOUBLE> d(arg);
+	double errF = 0.0, errM = 0.0, sig = 0.0;
+	for (int i = 0; i < REPORT_LEN; i++) {
+		double r = d(inTab[i]);
+		double yf = f(inTab[i]) - r, ym = m(inTab[i]) - r;
+		errF += yf * yf;
+		errM += ym * ym;
+		sig += r * r;
+	}
+
+	double sink = 0.0;
+	K<PREC_FLOAT> tf(arg);
+	K<PREC_MIXED> tm(arg);
+	K<PREC_DOUBLE> td(arg);
+	double nsF = timeKernel(tf, &sink), nsM = timeKernel(tm, &sink), nsD = timeKernel(td, &sink);
+
+	printf("%-24s float %6.1f dB %6.2f ns | mixed %6.1f dB %6.2f ns | double %6.2f ns%s\n", name,
+			10.0 * std::log10(sig / std::max(errF, 1e-300)), nsF,
+			10.0 * std::log10(sig / std::max(errM, 1e-300)), nsM,
+			nsD, std::isfinite(sink) ? "" : " (!)");
+}
+
+int main() {
+	contextSet(new Context);
+	APP->engine = new engine::Engine;
+	APP->engine->setSampleRate(REPORT_SR);
+	inputBuild();
+
+	printf("Signal to error ratio against PREC_DOUBLE, and cost per sample, at %.0f Hz\n\n", REPORT_SR);
+
+	const float fc[] = { 20.f, 200.f, 2000.f };
+	char name[64];
+	for (float f : fc) {
+		snprintf(name, sizeof(name), "SVF lowpass %g Hz", f);
+		report<SVFKernel>(name, f);
+	}
+	for (float f : fc) {
+		snprintf(name, sizeof(name), "ZDF SVF lowpass %g Hz", f);
+		report<ZDFKernel>(name, f);
+	}
+	report<RCKernel>("RCFilter tau 0.5 s", 0.5f);
+	report<FolderKernel>("ADAA folder", 3.5f);
+	report<OscKernel>("DPW 2 saw 55 Hz", (int)DPW_2);
+	report<OscKernel>("DPW 4 saw 55 Hz", (int)DPW_4);
+	report<OscKernel>("PolyBLEP saw 55 Hz", (int)OSC_POLYBLEP);
+
+	delete APP->engine;
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*--------------------------- ABC ---------------------------------*
+ *
+ * Author: Leonardo Gabrielli <l.gabrielli@univpm.it>
+ * License: GPLv3
+ *
+ * For a detailed guide of the code and functions see the book:
+ * "Developing Virtual Synthesizers with VCV Rack" by L.Gabrielli
+ *
+ * Copyright 2020, Leonardo Gabrielli
+ *
+ *-----------------------------------------------------------------*/
+
+/*
+ * Cost per sample of the SVF kernels of SVF.hpp, in the configurations the filter modules
+ * choose between. A standalone program, not part of the plugin:
+ *   make svf-benchmark && ./svf-benchmark
+ * Each row is the best of BENCH_REPEAT passes over the same input, in ns per sample of all
+ * the voices together.
+ */
+
+#include "rack.hpp"
+#include "SVF.hpp"
+#include "Oversampled.hpp"
+#include <chrono>
+#include <cstdio>
+
+using namespace rack;
+
+#define BENCH_SR 48000.f
+#define BENCH_LEN 96000		// samples per pass
+#define BENCH_REPEAT 7		// passes, the fastest one is reported
+#define BENCH_VOICES 16
+
+static float inTab[BENCH_LEN];
+static float cutTab[BENCH_LEN];
+
+/*
+ * The input of the SVF modules' benchmarks: 110 Hz at 5 V and 3001 Hz at 0.5 V. The cutoff
+ * sweeps 250 - 750 Hz at 2 Hz, so that the coefficients change at every sample
+ */
+static void inputBuild() {
+	for (int i = 0; i < BENCH_LEN; i++) {
+		inTab[i] = 5.f * std::sin(2.f * M_PI * 110.f * i / BENCH_SR) + 0.5f * std::sin(2.f * M_PI * 3001.f * i / BENCH_SR);
+		cutTab[i] = 500.f + 250.f * std::sin(2.f * M_PI * 2.f * i / BENCH_SR);
+	}
+}
+
+/*
+ * kernel(i, &acc) runs sample i and adds an output to acc, that is printed so that the
+ * compiler keeps the work
+ */
+template <typename K>
+double timeKernel(K kernel, double * sink) {
+	double best = 1e30;
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		float acc = 0.f;
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < BENCH_LEN; i++)
+			kernel(i, &acc);
+		auto t1 = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_LEN);
+		*sink += acc;
+	}
+	return best;
+}
+
+/*
+ * APolySVFilter: one scalar SVF per voice against one PolySVF per 4 voices, with the cutoff
+ * of each voice set at every sample (modulated) or only once (static)
+ */
+static void polySVF(double * sink) {
+	printf("Chamberlin SVF, %d voices\n", BENCH_VOICES);
+	for (int modulated = 1; modulated >= 0; modulated--) {
+		SVF<float> * scalar[BENCH_VOICES];
+		for (int c = 0; c < BENCH_VOICES; c++)
+			scalar[c] = new SVF<float>(500.f, 0.25f);
+		PolySVF poly[BENCH_VOICES/4];
+
+		double nsScalar = timeKernel([&](int i, float * acc) {
+			for (int c = 0; c < BENCH_VOICES; c++) {
+				float h, b, l;
+				scalar[c]->setCoeffs(modulated ? cutTab[i] * (1.f + 0.05f * c) : 500.f, 0.25f);
+				scalar[c]->process(inTab[i], &h, &b, &l);
+				*acc += l;
+			}
+		}, sink);
+		double nsPoly = timeKernel([&](int i, float * acc) {
+			for (int c = 0; c < BENCH_VOICES; c += 4) {
+				simd::float_4 h, b, l;
+				simd::float_4 detune = 1.f + 0.05f * simd::float_4(c, c + 1, c + 2, c + 3);
+				poly[c/4].setCoeffs(modulated ? cutTab[i] * detune : simd::float_4(500.f), 0.25f);
+				poly[c/4].process(inTab[i], &h, &b, &l);
+				*acc += l[0];
+			}
+		}, sink);
+		printf("  %-10s %d x SVF<float> %6.2f ns | %d x PolySVF %6.2f ns | x%.1f\n", modulated ? "modulated" : "static",
+				BENCH_VOICES, nsScalar, BENCH_VOICES/4, nsPoly, nsScalar / nsPoly);
+
+		for (int c = 0; c < BENCH_VOICES; c++)
+			delete scalar[c];
+	}
+}
+
+/*
+ * svfPhi(): the polynomial of SVF_FAST_PHI against sin(), per voice, for cutoffs from 20 Hz
+ * to 8 kHz. The error is against sin() in double, up to the clamp at fc * Ts = 1/6
+ */
+static void phi(double * sink) {
+	static float fcTab[BENCH_LEN];
+	for (int i = 0; i < BENCH_LEN; i++)
+		fcTab[i] = 20.f + (8000.f - 20.f) * i / BENCH_LEN;
+	float st = 1.f / BENCH_SR;
+
+	double nsFast = timeKernel([&](int i, float * acc) { *acc += svfPhiFast(fcTab[i], st); }, sink);
+	double nsExact = timeKernel([&](int i, float * acc) { *acc += svfPhiExact(fcTab[i], st); }, sink);
+	// 4 voices per call: 4 cutoffs per sample, the time is per voice
+	double nsFast4 = 0.25 * timeKernel([&](int i, float * acc) {
+		*acc += svfPhiFast(simd::float_4(fcTab[i]) * simd::float_4(1.f, 1.1f, 1.2f, 1.3f), simd::float_4(st))[0];
+	}, sink);
+	double nsExact4 = 0.25 * timeKernel([&](int i, float * acc) {
+		*acc += svfPhiExact(simd::float_4(fcTab[i]) * simd::float_4(1.f, 1.1f, 1.2f, 1.3f), simd::float_4(st))[0];
+	}, sink);
+
+	double errFast = 0.0, errExact = 0.0;
+	for (int i = 1; i <= BENCH_LEN; i++) {
+		double fc = BENCH_SR / 6.0 * i / BENCH_LEN;
+		double ref = std::min(2.0 * std::sin(M_PI * fc / BENCH_SR), 1.0);
+		errFast = std::max(errFast, std::fabs(svfPhiFast((float)fc, st) - ref));
+		errExact = std::max(errExact, std::fabs(svfPhiExact((float)fc, st) - ref));
+	}
+
+	printf("svfPhi, per voice\n");
+	printf("  float      fast %6.2f ns | exact %6.2f ns\n", nsFast, nsExact);
+	printf("  float_4    fast %6.2f ns | exact %6.2f ns\n", nsFast4, nsExact4);
+	printf("  max error  fast %.2e | exact %.2e\n", errFast, errExact);
+}
+
+/*
+ * ASVFilter: one voice of either engine behind Oversampled<>, as the module runs them, with
+ * the coefficients set at every sample (ctrlRate 1) or ramped over 16 samples (ctrlRate 16)
+ */
+template <typename F>
+static double svfOvs(int factor, int ctrlRate, double * sink) {
+	F filter(500.f, 0.25f);
+	Oversampled<float, 1, 1> ovs;
+	ovs.setFactor(factor);
+	filter.setSampleTime(1.f / (BENCH_SR * ovs.factor));
+	return timeKernel([&](int i, float * acc) {
+		if (i % ctrlRate == 0) {
+			if (ctrlRate > 1)
+				filter.setCoeffsTarget(cutTab[i], 0.25f, ctrlRate * ovs.factor);
+			else
+				filter.setCoeffs(cutTab[i], 0.25f);
+		}
+		float out;
+		ovs.process(&inTab[i], &out, [&](const float * x, float * y) {
+			float h, b;
+			filter.process(x[0], &h, &b, y);
+		});
+		*acc += out;
+	}, sink);
+}
+
+// the two engines behind one constructor, for svfOvs()
+struct ChamberlinBench : SVF<float> {
+	ChamberlinBench(float fc, float damp) : SVF<float>(fc, damp) {}
+};
+struct ZDFBench : ZDFSVF<float> {
+	ZDFBench(float fc, float damp) { setCoeffs(fc, damp); }
+};
+
+static void svfOversampling(double * sink) {
+	printf("SVF engines, 1 voice\n");
+	const int ctrlRates[] = { 1, 16 };
+	for (int ctrlRate : ctrlRates) {
+		printf("  ctrlRate %-2d ZDF 1x %6.2f ns | Chamberlin 1x %6.2f ns | Chamberlin 2x %6.2f ns | ZDF 2x %6.2f ns\n", ctrlRate,
+				svfOvs<ZDFBench>(1, ctrlRate, sink),
+				svfOvs<ChamberlinBench>(1, ctrlRate, sink),
+				svfOvs<ChamberlinBench>(2, ctrlRate, sink),
+				svfOvs<ZDFBench>(2, ctrlRate, sink));
+	}
+}
+
+int main() {
+	contextSet(new Context);
+	APP->engine = new engine::Engine;
+	APP->engine->setSampleRate(BENCH_SR);
+	inputBuild();
+
+	double sink = 0.0;
+	polySVF(&sink);
+	phi(&sink);
+	svfOversampling(&sink);
+
+	printf("\n(%g)\n", sink);
+	delete APP->engine;
+	return 0;
+}